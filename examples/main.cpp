@@ -5,6 +5,7 @@
  * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
@@ -79,8 +80,33 @@ int main(int argc, char **argv)
   const char *hdcache_path = "";
   const char *db_config = "";
   const char *db_type = "";
+  int db_async_buffers = 0;
 
   const char *uq_policy_opt = "mean";
+  const char *inference_opt = "full";
+  double selective_ratio = 0.5;
+  bool concurrent_inference = false;
+  int tile_size = 0;
+  int physics_threads = 0;
+  int physics_grain = 1024;
+  double target_physics_fraction = 0;
+  double physics_time_budget = 0;
+  double min_threshold = 0;
+  double max_threshold = 0;
+  int memo_capacity = 0;
+  double memo_tolerance = 0;
+  bool memo_physics_only = false;
+  bool temporal_coherence = false;
+  bool warmup = false;
+  const char *load_opt = "sync";
+  int model_poll_ms = 0;
+  int uq_add_batch = 0;
+  double uq_add_radius = 0;
+  int uq_max_points = 0;
+  int uq_search_chunk = 0;
+  const char *uq_search_params = "";
+  double uq_target_recall = 0;
+  int uq_memory_budget = 0;
   int k_nearest = 5;
 
   int seed = 0;
@@ -187,6 +213,12 @@ int main(int argc, char **argv)
                  "\t 'hdf5': use hdf5 as a back end\n"
                  "\t 'rmq': use RabbitMQ as a back end\n");
 
+  args.AddOption(&db_async_buffers,
+                 "-dba",
+                 "--db-async-buffers",
+                 "Number of staging buffers used to store data in the "
+                 "background (0 stores synchronously)");
+
   args.AddOption(&k_nearest, "-knn", "--k-nearest-neighbors", "Number of closest neightbors we should look at");
 
   args.AddOption(&uq_policy_opt,
@@ -197,6 +229,160 @@ int main(int argc, char **argv)
                  "\t 'max': Uncertainty is computed in comparison with the k'st cluster \n"
                  "\t 'deltauq': Uncertainty through DUQ (not supported)\n");
 
+  args.AddOption(&inference_opt,
+                 "-inf",
+                 "--inference",
+                 "Elements the surrogate model is evaluated on: \n"
+                 "\t 'full' All elements\n"
+                 "\t 'selective': Only elements accepted by the UQ module\n"
+                 "\t 'adaptive': Selective when the accepted fraction is below "
+                 "the selective ratio\n");
+
+  args.AddOption(&selective_ratio,
+                 "-sr",
+                 "--selective-ratio",
+                 "Accepted fraction below which 'adaptive' inference runs "
+                 "the model only on accepted elements");
+
+  args.AddOption(&concurrent_inference,
+                 "-ci",
+                 "--concurrent-inference",
+                 "-nci",
+                 "--no-concurrent-inference",
+                 "Run the surrogate model concurrently with the physics "
+                 "module (cpu only)");
+
+  args.AddOption(&tile_size,
+                 "-ts",
+                 "--tile-size",
+                 "Maximum number of elements AMS processes at once (0 "
+                 "processes all elements at once)");
+
+  args.AddOption(&physics_threads,
+                 "-pt",
+                 "--physics-threads",
+                 "Number of threads AMS uses to invoke the physics module "
+                 "(cpu only, 0 invokes it once)");
+
+  args.AddOption(&physics_grain,
+                 "-pg",
+                 "--physics-grain",
+                 "Number of elements per physics invocation when using "
+                 "physics threads");
+
+  args.AddOption(&target_physics_fraction,
+                 "-tpf",
+                 "--target-physics-fraction",
+                 "Adapt the threshold so that physics computes this fraction "
+                 "of the elements (0 keeps the threshold fixed)");
+
+  args.AddOption(&physics_time_budget,
+                 "-ptb",
+                 "--physics-time-budget",
+                 "Adapt the threshold so that an AMS execution takes this "
+                 "many seconds (0 keeps the threshold fixed)");
+
+  args.AddOption(&min_threshold,
+                 "-mint",
+                 "--min-threshold",
+                 "Smallest threshold when adapting the threshold");
+
+  args.AddOption(&max_threshold,
+                 "-maxt",
+                 "--max-threshold",
+                 "Largest threshold when adapting the threshold (0 is "
+                 "unbounded)");
+
+  args.AddOption(&memo_capacity,
+                 "-memo",
+                 "--memo-capacity",
+                 "Number of elements of the memoization cache (cpu only, 0 "
+                 "disables memoization)");
+
+  args.AddOption(&memo_tolerance,
+                 "-memot",
+                 "--memo-tolerance",
+                 "Quantization step of the memoized inputs");
+
+  args.AddOption(&memo_physics_only,
+                 "-memop",
+                 "--memo-physics-only",
+                 "-memoa",
+                 "--memo-all",
+                 "Memoize only outputs computed by the physics module");
+
+  args.AddOption(&temporal_coherence,
+                 "-tc",
+                 "--temporal-coherence",
+                 "-ntc",
+                 "--no-temporal-coherence",
+                 "Skip the UQ search of elements whose inputs barely changed "
+                 "since the previous cycle");
+
+  args.AddOption(&warmup,
+                 "-wu",
+                 "--warmup",
+                 "-nwu",
+                 "--no-warmup",
+                 "Warm up the UQ module and the surrogate model with the "
+                 "element count of a material when creating the executor");
+
+  args.AddOption(&load_opt,
+                 "-load",
+                 "--load-models",
+                 "How to load the surrogate model and the UQ module: \n"
+                 "\t 'sync' Before the executor is created\n"
+                 "\t 'blocking': In the background, the first execution waits "
+                 "for them\n"
+                 "\t 'fallback': In the background, executions use physics "
+                 "until they are loaded\n");
+
+  args.AddOption(&model_poll_ms,
+                 "-reload",
+                 "--model-reload-ms",
+                 "Check for a new surrogate model at the model path every "
+                 "this many milliseconds (0 disables reloading)");
+
+  args.AddOption(&uq_add_batch,
+                 "-uqadd",
+                 "--uq-add-batch",
+                 "Add the inputs computed by physics to the UQ index in "
+                 "batches of this many elements (0 disables it)");
+
+  args.AddOption(&uq_add_radius,
+                 "-uqr",
+                 "--uq-add-radius",
+                 "Do not add inputs closer than this to the UQ index");
+
+  args.AddOption(&uq_max_points,
+                 "-uqmax",
+                 "--uq-max-points",
+                 "Stop adding inputs once the UQ index holds this many points "
+                 "(0 means no limit)");
+
+  args.AddOption(&uq_search_chunk,
+                 "-uqchunk",
+                 "--uq-search-chunk",
+                 "Number of elements every thread of a UQ search processes "
+                 "at once (0 chooses it from the number of elements)");
+
+  args.AddOption(&uq_search_params,
+                 "-uqparams",
+                 "--uq-search-params",
+                 "FAISS search parameters of the UQ index, e.g. 'nprobe=16'");
+
+  args.AddOption(&uq_target_recall,
+                 "-uqrecall",
+                 "--uq-target-recall",
+                 "Pick the cheapest UQ search parameters finding this "
+                 "fraction of the nearest neighbors (0 disables it)");
+
+  args.AddOption(&uq_memory_budget,
+                 "-uqmem",
+                 "--uq-memory-budget",
+                 "Compress the UQ index to use at most this many MiB "
+                 "(0 means no limit)");
+
   args.AddOption(
       &verbose, "-v", "--verbose", "-qu", "--quiet", "Print extra stuff");
 
@@ -273,6 +459,18 @@ int main(int argc, char **argv)
     uq_policy = ((std::strcmp(uq_policy_opt, "deltauq") == 0))
       ? AMSUQPolicy::DeltaUQ : AMSUQPolicy::FAISSMean;
 
+  AMSInferencePolicy inf_policy = AMSInferencePolicy::FullInference;
+  if (std::strcmp(inference_opt, "selective") == 0)
+    inf_policy = AMSInferencePolicy::SelectiveInference;
+  else if (std::strcmp(inference_opt, "adaptive") == 0)
+    inf_policy = AMSInferencePolicy::AdaptiveInference;
+
+  AMSLoadPolicy load_policy = AMSLoadPolicy::SyncLoad;
+  if (std::strcmp(load_opt, "blocking") == 0)
+    load_policy = AMSLoadPolicy::AsyncLoadBlocking;
+  else if (std::strcmp(load_opt, "fallback") == 0)
+    load_policy = AMSLoadPolicy::AsyncLoadFallback;
+
   // set up a randomization seed
   srand(seed + rId);
 
@@ -425,6 +623,11 @@ int main(int argc, char **argv)
   AMSExecPolicy ams_loadBalance = AMSExecPolicy::UBALANCED;
   if ( lbalance ) ams_loadBalance = AMSExecPolicy::BALANCED;
 
+  // Materials hold about num_elems / num_mats elements of num_qpts points
+  const long warmup_sizes[] = {
+      std::max(1L, long(num_elems) * num_qpts / num_mats),
+      long(num_elems) * num_qpts};
+
   AMSConfig amsConf = {ams_loadBalance,
                        AMSDType::Double,
                        ams_device,
@@ -437,7 +640,34 @@ int main(int argc, char **argv)
                        uq_policy,
                        k_nearest,
                        rId,
-                       wS };
+                       wS,
+                       db_async_buffers,
+                       inf_policy,
+                       selective_ratio,
+                       concurrent_inference,
+                       tile_size,
+                       physics_threads,
+                       physics_grain,
+                       target_physics_fraction,
+                       physics_time_budget,
+                       min_threshold,
+                       max_threshold,
+                       memo_capacity,
+                       memo_tolerance,
+                       memo_physics_only,
+                       temporal_coherence,
+                       warmup ? warmup_sizes : nullptr,
+                       2,
+                       load_policy,
+                       model_poll_ms,
+                       nullptr,
+                       uq_add_batch,
+                       uq_add_radius,
+                       uq_max_points,
+                       uq_search_chunk,
+                       uq_search_params,
+                       uq_target_recall,
+                       uq_memory_budget};
   AMSExecutor wf = AMSCreateExecutor(amsConf);
 
   for (int mat_idx = 0; mat_idx < num_mats; ++mat_idx) {
@@ -693,6 +923,11 @@ int main(int argc, char **argv)
     MPI_CALL(MPI_Barrier(MPI_COMM_WORLD));
   }
   CALIPER(CALI_MARK_END("TimeStepLoop"););
+#ifdef USE_AMS
+  // Flushes pending database stores
+  AMSDestroyExecutor(wf);
+  delete[] workflow;
+#endif
   MPI_CALL(MPI_Finalize());
   return 0;
 }
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+// Measures the accuracy of compressed UQ indices against their memory.
+//
+// The benchmark indexes clustered synthetic points in a flat index and
+// compresses it under shrinking memory budgets with HDCache. For every
+// budget it reports the index chosen, its footprint, the recall of the k
+// nearest neighbors, the relative error of the mean neighbor distance the
+// FAISSMean policy thresholds, the fraction of UQ decisions that match the
+// flat index at the median distance, and the search time.
+//
+// Usage: ams_uq_benchmark [points] [dimension] [neighbors] [queries] [out]
+// When 'out' is given, the index of the smallest budget is written to it.
+
+#include <faiss/AutoTune.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/index_io.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "AMS.h"
+#include "ml/hdcache.hpp"
+
+using Cache = HDCache<float>;
+using idx_t = faiss::Index::idx_t;
+
+struct Result {
+  std::vector<float> dists;
+  std::vector<idx_t> labels;
+  double seconds;
+};
+
+static Result search(const faiss::Index &index,
+                     const std::vector<float> &queries,
+                     int dim,
+                     int k)
+{
+  const size_t nq = queries.size() / dim;
+  Result result;
+  result.dists.resize(nq * k);
+  result.labels.resize(nq * k);
+  auto start = std::chrono::steady_clock::now();
+  index.search(
+      nq, queries.data(), k, result.dists.data(), result.labels.data());
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return result;
+}
+
+static std::vector<double> meanDistances(const Result &result, int k)
+{
+  std::vector<double> means(result.dists.size() / k);
+  for (size_t i = 0; i < means.size(); i++) {
+    double sum = 0;
+    for (int j = 0; j < k; j++)
+      sum += result.dists[i * k + j];
+    means[i] = sum / k;
+  }
+  return means;
+}
+
+int main(int argc, char *argv[])
+{
+  const size_t npoints = (argc > 1) ? std::atol(argv[1]) : 1000000;
+  const int dim = (argc > 2) ? std::atoi(argv[2]) : 8;
+  const int k = (argc > 3) ? std::atoi(argv[3]) : 10;
+  const size_t nqueries = (argc > 4) ? std::atol(argv[4]) : 10000;
+  const char *out = (argc > 5) ? argv[5] : nullptr;
+
+  // Points gather around a few hundred centers, like the states a
+  // simulation visits. Queries are perturbed points.
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  std::normal_distribution<float> normal(0, 0.02);
+  const int ncenters = 256;
+  std::vector<float> centers(ncenters * dim);
+  for (auto &c : centers)
+    c = uniform(gen);
+  std::vector<float> points(npoints * dim), queries(nqueries * dim);
+  for (size_t i = 0; i < npoints; i++) {
+    const int c = gen() % ncenters;
+    for (int d = 0; d < dim; d++)
+      points[i * dim + d] = centers[c * dim + d] + normal(gen);
+  }
+  for (size_t i = 0; i < nqueries; i++) {
+    const size_t p = gen() % npoints;
+    for (int d = 0; d < dim; d++)
+      queries[i * dim + d] = points[p * dim + d] + normal(gen);
+  }
+
+  faiss::IndexFlatL2 flat(dim);
+  flat.add(npoints, points.data());
+  const Result exact = search(flat, queries, dim, k);
+  const std::vector<double> exactMeans = meanDistances(exact, k);
+  std::vector<double> sorted(exactMeans);
+  std::nth_element(sorted.begin(),
+                   sorted.begin() + sorted.size() / 2,
+                   sorted.end());
+  const double threshold = sorted[sorted.size() / 2];
+
+  const size_t flatBytes = Cache::index_footprint(&flat);
+  std::printf("%zu points of dimension %d, %zu queries, k = %d\n",
+              npoints,
+              dim,
+              nqueries,
+              k);
+  std::printf("%-10s %-20s %12s %8s %10s %10s %10s\n",
+              "budget",
+              "index",
+              "MiB",
+              "recall",
+              "dist err",
+              "decisions",
+              "search s");
+
+  std::unique_ptr<faiss::Index> smallest;
+  for (int shift = 0; shift <= 5; shift++) {
+    const size_t budget = flatBytes >> shift;
+    std::unique_ptr<faiss::Index> compressed(
+        Cache::compress_index(&flat, budget));
+    const faiss::Index &index = compressed ? *compressed : flat;
+    if (compressed) {
+      // Probe enough lists to make the quantization the main error
+      faiss::ParameterSpace().set_index_parameters(compressed.get(),
+                                                   "nprobe=16");
+    }
+    const std::string key =
+        compressed ? Cache::compressed_key(npoints, dim, budget) : "Flat";
+
+    const Result result = search(index, queries, dim, k);
+    const std::vector<double> means = meanDistances(result, k);
+    size_t found = 0, agree = 0;
+    double error = 0;
+    for (size_t q = 0; q < nqueries; q++) {
+      std::unordered_set<idx_t> truth(exact.labels.begin() + q * k,
+                                      exact.labels.begin() + (q + 1) * k);
+      for (int j = 0; j < k; j++)
+        found += truth.count(result.labels[q * k + j]);
+      error += std::abs(means[q] - exactMeans[q]) /
+               std::max(exactMeans[q], 1e-12);
+      agree += (means[q] < threshold) == (exactMeans[q] < threshold);
+    }
+
+    std::printf("1/%-8d %-20s %12.2f %8.4f %10.4f %10.4f %10.4f\n",
+                1 << shift,
+                key.c_str(),
+                Cache::index_footprint(&index) / (1024.0 * 1024.0),
+                double(found) / (nqueries * k),
+                error / nqueries,
+                double(agree) / nqueries,
+                result.seconds);
+    if (compressed) smallest = std::move(compressed);
+  }
+
+  if (out != nullptr && smallest) {
+    faiss::write_index(smallest.get(), out);
+    std::printf("Wrote the smallest index to %s\n", out);
+  }
+  return 0;
+}
@@ -5,13 +5,51 @@
  * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
  */
 
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "AMS.h"
 #include "wf/workflow.hpp"
 
 struct AMSWrap{
-  std::vector<std::pair<AMSDType, void *>> executors;
+  using Executor = std::pair<AMSDType, void *>;
+  std::vector<Executor> executors;
+  /* Executors are created once and looked up on every execution, so lookups
+   * only take a shared lock and concurrent executions never wait for each
+   * other. */
+  mutable std::shared_timed_mutex mtx;
+
+  uint64_t add(Executor exec)
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(mtx);
+    executors.push_back(exec);
+    return executors.size() - 1L;
+  }
+
+  Executor get(AMSExecutor executor) const
+  {
+    uint64_t index = reinterpret_cast<uint64_t>(executor);
+    std::shared_lock<std::shared_timed_mutex> lock(mtx);
+    if (index >= executors.size())
+      throw std::runtime_error("AMS Executor identifier does not exist\n");
+    if (executors[index].second == nullptr)
+      throw std::runtime_error("AMS Executor has been destroyed\n");
+    return executors[index];
+  }
+
+  Executor remove(AMSExecutor executor)
+  {
+    uint64_t index = reinterpret_cast<uint64_t>(executor);
+    std::unique_lock<std::shared_timed_mutex> lock(mtx);
+    if (index >= executors.size())
+      throw std::runtime_error("AMS Executor identifier does not exist\n");
+    Executor exec = executors[index];
+    executors[index].second = nullptr;
+    return exec;
+  }
+
   ~AMSWrap() {
     for ( auto E : executors ){
       if ( E.second != nullptr ){
@@ -29,19 +67,15 @@ static AMSWrap _amsWrap;
 
 void _AMSExecute(AMSExecutor executor,
                  void *probDescr,
-                 const int numElements,
+                 const long numElements,
                  const void **input_data,
                  void **output_data,
                  int inputDim,
                  int outputDim,
                  MPI_Comm Comm = 0)
 {
-  uint64_t index = reinterpret_cast<uint64_t>(executor);
+  auto currExec = _amsWrap.get(executor);
 
-  if (index >= _amsWrap.executors.size())
-    throw std::runtime_error("AMS Executor identifier does not exist\n");
-
-  auto currExec = _amsWrap.executors[index];
   if (currExec.first == AMSDType::Double) {
     ams::AMSWorkflow<double> *dWF =
         reinterpret_cast<ams::AMSWorkflow<double> *>(currExec.second);
@@ -68,6 +102,53 @@ void _AMSExecute(AMSExecutor executor,
   }
 }
 
+template <typename FPTypeValue>
+AMSExecutor _AMSCreateExecutor(const AMSConfig &config)
+{
+  ams::AMSWorkflow<FPTypeValue> *WF =
+      new ams::AMSWorkflow<FPTypeValue>(config.cBack,
+                                        config.UQPath,
+                                        config.SPath,
+                                        config.DBPath,
+                                        config.dbType,
+                                        config.device == AMSResourceType::HOST,
+                                        static_cast<FPTypeValue>(config.threshold),
+                                        config.uqPolicy,
+                                        config.nClusters,
+                                        config.pId,
+                                        config.wSize,
+                                        config.ePolicy,
+                                        config.loadPolicy);
+  WF->set_db_async(config.dbAsyncBuffers);
+  WF->set_inference_policy(config.infPolicy, config.selectiveRatio);
+  WF->set_concurrent_inference(config.concurrentInference != 0);
+  WF->set_tile_size(config.tileSize);
+  WF->set_parallel_physics(config.physicsThreads, config.physicsGrain);
+  WF->set_memoization(config.memoCapacity,
+                      config.memoTolerance,
+                      config.memoPhysicsOnly != 0);
+  WF->set_temporal_coherence(config.temporalCoherence != 0);
+  WF->set_threshold_controller(config.targetPhysicsFraction,
+                               config.physicsTimeBudget,
+                               config.minThreshold,
+                               config.maxThreshold);
+  WF->set_uq_search_chunk(config.uqSearchChunk);
+  WF->set_uq_search(config.uqSearchParams,
+                    config.uqTargetRecall,
+                    config.uqMemoryBudget);
+
+  if (config.warmupBatchSizes != nullptr)
+    WF->warmup(std::vector<long>(
+        config.warmupBatchSizes,
+        config.warmupBatchSizes + config.numWarmupBatchSizes));
+  WF->set_model_reload(config.modelPollMs, config.modelWatchPath);
+  WF->set_online_uq(config.uqAddBatch, config.uqAddRadius, config.uqMaxPoints);
+
+  uint64_t index =
+      _amsWrap.add(std::make_pair(config.dType, static_cast<void *>(WF)));
+  return reinterpret_cast<AMSExecutor>(index);
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -75,39 +156,9 @@ extern "C" {
 AMSExecutor AMSCreateExecutor(const AMSConfig config)
 {
   if (config.dType == Double) {
-    ams::AMSWorkflow<double> *dWF =
-        new ams::AMSWorkflow<double>(config.cBack,
-                                     config.UQPath,
-                                     config.SPath,
-                                     config.DBPath,
-                                     config.dbType,
-                                     config.device == AMSResourceType::HOST,
-                                     config.threshold,
-                                     config.uqPolicy,
-                                     config.nClusters,
-                                     config.pId,
-                                     config.wSize,
-                                     config.ePolicy);
-
-    _amsWrap.executors.push_back(std::make_pair(config.dType, static_cast<void *>(dWF)));
-    return reinterpret_cast<AMSExecutor>(_amsWrap.executors.size() - 1L);
+    return _AMSCreateExecutor<double>(config);
   } else if (config.dType == AMSDType::Single) {
-    ams::AMSWorkflow<float> *sWF =
-        new ams::AMSWorkflow<float>(config.cBack,
-                                    config.UQPath,
-                                    config.SPath,
-                                    config.DBPath,
-                                    config.dbType,
-                                    config.device == AMSResourceType::HOST,
-                                    static_cast<float>(config.threshold),
-                                    config.uqPolicy,
-                                    config.nClusters,
-                                    config.pId,
-                                    config.wSize,
-                                    config.ePolicy);
-    _amsWrap.executors.push_back(std::make_pair(config.dType, static_cast<void *>(sWF)));
-
-    return reinterpret_cast<AMSExecutor>(_amsWrap.executors.size() - 1L);
+    return _AMSCreateExecutor<float>(config);
   } else {
     throw std::invalid_argument("Data type is not supported by AMSLib!");
     return reinterpret_cast<AMSExecutor>(-1L);
@@ -116,7 +167,7 @@ AMSExecutor AMSCreateExecutor(const AMSConfig config)
 
 void AMSExecute(AMSExecutor executor,
                 void *probDescr,
-                const int numElements,
+                const long numElements,
                 const void **input_data,
                 void **output_data,
                 int inputDim,
@@ -131,11 +182,41 @@ void AMSExecute(AMSExecutor executor,
               outputDim);
 }
 
+void AMSExecuteBatch(AMSBatchItem *items,
+                     int numItems,
+                     int inputDim,
+                     int outputDim)
+{
+  // Group items by executor, keeping the order in which they were given.
+  // Only the items of a workflow fuse, executors sharing a model keep
+  // their own UQ module, thresholds and database.
+  std::vector<uint64_t> order;
+  std::unordered_map<uint64_t, std::vector<AMSBatchItem>> groups;
+  for (int i = 0; i < numItems; i++) {
+    uint64_t index = reinterpret_cast<uint64_t>(items[i].executor);
+    if (groups.find(index) == groups.end()) order.push_back(index);
+    groups[index].push_back(items[i]);
+  }
+
+  for (auto index : order) {
+    auto currExec = _amsWrap.get(reinterpret_cast<AMSExecutor>(index));
+    if (currExec.first == AMSDType::Double) {
+      reinterpret_cast<ams::AMSWorkflow<double> *>(currExec.second)
+          ->evaluateBatch(groups[index], inputDim, outputDim);
+    } else if (currExec.first == AMSDType::Single) {
+      reinterpret_cast<ams::AMSWorkflow<float> *>(currExec.second)
+          ->evaluateBatch(groups[index], inputDim, outputDim);
+    } else {
+      throw std::invalid_argument("Data type is not supported by AMSLib!");
+    }
+  }
+}
+
 #ifdef __ENABLE_MPI__
 void AMSDistributedExecute(AMSExecutor executor,
                            MPI_Comm Comm,
                            void *probDescr,
-                           const int numElements,
+                           const long numElements,
                            const void **input_data,
                            void **output_data,
                            int inputDim,
@@ -152,6 +233,30 @@ void AMSDistributedExecute(AMSExecutor executor,
 }
 #endif
 
+void AMSGetStats(AMSExecutor executor, AMSStats *stats)
+{
+  auto currExec = _amsWrap.get(executor);
+  if (currExec.first == AMSDType::Double) {
+    reinterpret_cast<ams::AMSWorkflow<double> *>(currExec.second)
+        ->getStats(*stats);
+  } else if (currExec.first == AMSDType::Single) {
+    reinterpret_cast<ams::AMSWorkflow<float> *>(currExec.second)
+        ->getStats(*stats);
+  } else {
+    throw std::invalid_argument("Data type is not supported by AMSLib!");
+  }
+}
+
+void AMSDestroyExecutor(AMSExecutor executor)
+{
+  auto currExec = _amsWrap.remove(executor);
+  // Deleting the workflow flushes all pending database stores
+  if (currExec.first == AMSDType::Double) {
+    delete reinterpret_cast<ams::AMSWorkflow<double> *>(currExec.second);
+  } else if (currExec.first == AMSDType::Single) {
+    delete reinterpret_cast<ams::AMSWorkflow<float> *>(currExec.second);
+  }
+}
 
 const char *AMSGetAllocatorName(AMSResourceType device)
 {
@@ -63,6 +63,24 @@ typedef enum {
   DeltaUQ // Not supported
 } AMSUQPolicy;
 
+typedef enum {
+  FullInference = 0, // Run the surrogate on all elements
+  SelectiveInference, // Run the surrogate only on UQ-accepted elements
+  AdaptiveInference // Pick between the two from the accepted fraction
+} AMSInferencePolicy;
+
+/* How the surrogate model and the UQ module are loaded when creating an
+ * executor:
+ *  SyncLoad: before AMSCreateExecutor returns,
+ *  AsyncLoadBlocking: in the background, the first execution waits for them,
+ *  AsyncLoadFallback: in the background, executions compute all elements
+ *  with the physics function until they are loaded. */
+typedef enum {
+  SyncLoad = 0,
+  AsyncLoadBlocking,
+  AsyncLoadFallback
+} AMSLoadPolicy;
+
 typedef struct ams_conf {
   const AMSExecPolicy ePolicy;
   const AMSDType dType;
@@ -77,28 +95,178 @@ typedef struct ams_conf {
   const int nClusters;
   int pId;
   int wSize;
+  /* Number of staging buffers used to store data to the database from a
+   * background thread. When 0 data are stored synchronously. */
+  int dbAsyncBuffers;
+  /* The elements the surrogate model is evaluated on */
+  AMSInferencePolicy infPolicy;
+  /* With AdaptiveInference, run the surrogate only on the accepted elements
+   * when they are less than this fraction of all elements (default 0.5) */
+  double selectiveRatio;
+  /* When non zero the surrogate model runs on a dedicated thread while the
+   * physics module computes the rejected elements (CPU only) */
+  int concurrentInference;
+  /* Maximum number of elements processed at once. Larger problems are
+   * streamed through AMS in tiles of this size, bounding the memory AMS
+   * allocates. When 0 all elements are processed at once. */
+  long tileSize;
+  /* Number of host threads invoking the physics function on disjoint chunks
+   * of the rejected elements (CPU only). The physics function must then be
+   * reentrant for disjoint ranges. When 0 or 1 it is invoked once on all
+   * rejected elements. */
+  int physicsThreads;
+  /* Number of elements of each chunk of parallel physics (default 1024) */
+  long physicsGrain;
+  /* When non zero, the threshold is adjusted after every execution so that
+   * the physics function computes about this fraction of the elements */
+  double targetPhysicsFraction;
+  /* When non zero, the threshold is adjusted after every execution so that
+   * an execution takes about this many seconds */
+  double physicsTimeBudget;
+  /* Bounds of the adjusted threshold. The lower bound is at least the float
+   * epsilon, a threshold of 0 could not grow. */
+  double minThreshold;
+  double maxThreshold;
+  /* Number of elements of the memoization cache returning the outputs of
+   * previously seen inputs (CPU only). When 0 no memoization takes place. */
+  long memoCapacity;
+  /* Inputs that differ less than this value map to the same memoized
+   * outputs. When 0 inputs need to match exactly. */
+  double memoTolerance;
+  /* When non zero only outputs computed by the physics function are
+   * memoized, otherwise surrogate outputs are memoized as well */
+  int memoPhysicsOnly;
+  /* When non zero, the UQ search is skipped for elements whose inputs moved
+   * too little since the previous executions to change their decision. The
+   * application has to pass the same elements in the same order across
+   * executions (CPU, FAISS L2 indices only). */
+  int temporalCoherence;
+  /* Numbers of elements the UQ module and the surrogate model are evaluated
+   * on with synthetic inputs when the executor is created, so that the first
+   * execution runs at steady-state latency. Not used when NULL. */
+  const long *warmupBatchSizes;
+  int numWarmupBatchSizes;
+  AMSLoadPolicy loadPolicy;
+  /* When non zero, a background thread checks every modelPollMs
+   * milliseconds for a new surrogate model and swaps it in between
+   * executions. A new model is picked up when the file at modelWatchPath
+   * (SPath when NULL) is modified, or when the database receives a message
+   * "ams-reload-model [path]" (RabbitMQ inbound queue). Write new models to
+   * a temporary file and rename it over the watched path. */
+  int modelPollMs;
+  const char *modelWatchPath;
+  /* When non zero, inputs computed by the physics function are added to
+   * the UQ index in batches of this many elements, so that their region is
+   * accepted from then on (CPU, FAISS indices only) */
+  long uqAddBatch;
+  /* Inputs closer than this L2 distance to an indexed point are not added */
+  double uqAddRadius;
+  /* Points are no longer added once the index holds this many. When 0 the
+   * index grows without limit. */
+  long uqMaxPoints;
+  /* Number of elements every thread of a host UQ search processes at once.
+   * When 0 it is chosen from the number of elements and threads. */
+  long uqSearchChunk;
+  /* FAISS search parameters of the UQ index, such as "nprobe=16" for IVF or
+   * "efSearch=64" for HNSW indices. Not used when NULL. Executors sharing
+   * an index share its search parameters. */
+  const char *uqSearchParams;
+  /* When non zero, the first execution picks the cheapest FAISS search
+   * parameters that find this fraction of the nearest neighbors on a sample
+   * of its inputs (CPU only) */
+  double uqTargetRecall;
+  /* Memory the UQ index of an executor may use in MiB. Larger FAISS indices
+   * are compressed with scalar or product quantization on load. When 0 the
+   * index is used as is. */
+  long uqMemoryBudget;
 } AMSConfig;
 
+/* The stages of an execution timed by AMSGetStats */
+typedef enum {
+  StageUQ = 0,
+  StageSurrogate,
+  StagePack,
+  StagePhysics,
+  StageUnpack,
+  StageLoadBalance,
+  StageDBStore,
+  StageMemoization,
+  StageEnd
+} AMSStage;
+
+/* Statistics accumulated by an executor since its creation */
+typedef struct ams_stats {
+  /* Number of executions */
+  unsigned long long calls;
+  /* Elements of all executions */
+  unsigned long long totalElements;
+  /* Elements computed by the physics function */
+  unsigned long long physicsElements;
+  /* Elements the surrogate model was evaluated on */
+  unsigned long long surrogateElements;
+  /* Bytes handed to the database */
+  unsigned long long bytesStored;
+  /* Allocations of temporary buffers performed by AMS */
+  unsigned long long allocations;
+  /* Cumulative time spent in every stage */
+  unsigned long long stageNanoseconds[StageEnd];
+  /* Longest time a single invocation of every stage took */
+  unsigned long long stageMaxNanoseconds[StageEnd];
+  /* Elements whose outputs were found in the memoization cache */
+  unsigned long long memoHits;
+  /* Largest number of bytes of scratch memory a single execution used */
+  unsigned long long scratchHighWaterBytes;
+} AMSStats;
+
+/* A single problem of a batched execution. Items sharing an executor are
+ * evaluated together: the surrogate model runs once on all of them, while
+ * the physics function is called once per item with its own descriptor.
+ * Only items of the same executor are fused, items of different executors
+ * run separately even when the executors share a model. Problems that
+ * share a surrogate model and a UQ module, such as materials, fuse when
+ * they use a single executor and differ by their descriptor. Items are not
+ * fused while the models load, with memoization, or when together they
+ * exceed the tile size; they are then evaluated one after the other. */
+typedef struct ams_batch_item {
+  AMSExecutor executor;
+  void *probDescr;
+  long numElements;
+  const void **inputs;
+  void **outputs;
+} AMSBatchItem;
+
 AMSExecutor AMSCreateExecutor(const AMSConfig config);
 
 #ifdef __AMS_ENABLE_MPI__
 void AMSDistributedExecute(AMSExecutor executor,
                            MPI_Comm Comm,
                            void *probDescr,
-                           const int numElements,
+                           const long numElements,
                            const void **input_data,
                            void **output_data,
                            int inputDim,
                            int outputDim);
 #endif
+/* AMSCreateExecutor, AMSExecute and AMSExecuteBatch may be called
+ * concurrently from multiple host threads (e.g. an OpenMP loop over
+ * materials), including on the same executor. Concurrent calls must not
+ * share output buffers. AMSDestroyExecutor must not race with calls on the
+ * executor it destroys. */
 void AMSExecute(AMSExecutor executor,
                 void *probDescr,
-                const int numElements,
+                const long numElements,
                 const void **input_data,
                 void **output_data,
                 int inputDim,
                 int outputDim);
 
+void AMSExecuteBatch(AMSBatchItem *items,
+                     int numItems,
+                     int inputDim,
+                     int outputDim);
+
+void AMSGetStats(AMSExecutor executor, AMSStats *stats);
+
 void AMSDestroyExecutor(AMSExecutor executor);
 
 #ifdef __AMS_ENABLE_MPI__
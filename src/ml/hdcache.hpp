@@ -9,17 +9,23 @@
 #define __AMS_HDCACHE_HPP__
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <numeric>
+#include <shared_mutex>
 #include <stdexcept>
 #include <string>
 #include <type_traits>
 #include <vector>
 
 #ifdef __ENABLE_FAISS__
+#include <faiss/AutoTune.h>
 #include <faiss/IndexFlat.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/clone_index.h>
+#include <faiss/impl/io.h>
 #include <faiss/index_factory.h>
 #include <faiss/index_io.h>
 
@@ -32,11 +38,18 @@
 #endif
 
 #include "AMS.h"
+#include "ml/knn.hpp"
+#include "ml/registry.hpp"
 #include "wf/data_handler.hpp"
 #include "wf/resource_manager.hpp"
+#include "wf/thread_pool.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 //! ----------------------------------------------------------------------------
-//! An implementation of FAISS-based HDCache
+//! An implementation of HDCache based on FAISS or on the native kNN engine
 //! ----------------------------------------------------------------------------
 template <typename TypeInValue>
 class HDCache
@@ -49,21 +62,38 @@ class HDCache
 #ifdef __ENABLE_FAISS__
   using Index = faiss::Index;
   using TypeIndex = faiss::Index::idx_t;  // 64-bit int
-  using TypeValue = float;                // faiss uses floats
 #ifdef __ENABLE_CUDA__
   faiss::gpu::StandardGpuResources res;
   faiss::gpu::GpuClonerOptions copyOptions;
 #endif
 #else
   using Index = void;
-  using TypeIndex = uint64_t;
-  using TypeValue = TypeInValue;
+  using TypeIndex = ams::KNNIndex::Label;
 #endif
+  using TypeValue = float;  // faiss and the native engine use floats
+  static_assert(sizeof(TypeIndex) == sizeof(ams::KNNIndex::Label),
+                "FAISS and the native engine need the same labels");
   using data_handler =
       ams::DataHandler<TypeValue>;  // utils to handle float data
 
+  /** @brief A FAISS index shared through the registry. Changing its search
+   * parameters holds its lock exclusively, searches hold it shared */
+  struct SharedIndex {
+    std::shared_ptr<Index> index;
+    std::shared_timed_mutex mtx;
+  };
+
+  /** @brief Owns the index. Indices loaded from a file are shared with
+   * the other caches loading the same file until they are modified */
+  std::shared_ptr<Index> m_owner;
+  bool m_shared = false;
+  /** @brief The shared FAISS index, null once the index is private */
+  std::shared_ptr<SharedIndex> m_shared_index;
   Index *m_index = nullptr;
-  const uint8_t m_dim;
+  /** @brief The native index, set instead of m_index when the cache file
+   * holds a native index */
+  std::shared_ptr<ams::KNNIndex> m_knn;
+  uint8_t m_dim;
 
   const bool m_use_random;
   const bool m_use_device;
@@ -72,11 +102,40 @@ class HDCache
 
   AMSResourceType defaultRes;
 
-  const TypeValue acceptable_error;
+  /** @brief The threshold below which the distance to the neighbors is
+   * acceptable. It may be updated while other threads evaluate the cache */
+  std::atomic<TypeValue> acceptable_error;
+
+  /** @brief Searches hold it shared, adding points holds it exclusively */
+  mutable std::shared_timed_mutex m_mtx;
+
+  /** @brief Incremented every time points are added to the index */
+  std::atomic<uint64_t> m_version{0};
+
+  /** @brief The number of points host searches process per task, chosen
+   * from the number of points and threads when 0 */
+  std::atomic<size_t> m_search_chunk{0};
+
+  /** @brief The search results of a thread, reused across evaluations */
+  struct SearchBuffers {
+    std::vector<TypeValue> kdists;
+    std::vector<TypeIndex> kidxs;
+  };
+
+
+  /** @brief The file the index was loaded from, empty otherwise */
+  std::string m_path;
+
+  /** @brief The search parameters of the index (see set_search_params) */
+  std::string m_search_params;
 
+  /** @brief The memory the index may use in bytes, no limit when 0 (see
+   * set_memory_budget) */
+  size_t m_memory_budget = 0;
 
 #ifdef __ENABLE_FAISS__
-  const char *index_key = "IVF4096,Flat";
+  /** @brief The FAISS index factory string train creates indices with */
+  std::string index_key = "IVF4096,Flat";
   // const char* index_key = "IndexFlatL2";
   // const char* index_key = "IndexFlatL2";
   // const char* index_key = "GpuIndexFlatL2";
@@ -105,14 +164,14 @@ public:
     print();
   }
 
-#ifdef __ENABLE_FAISS__
+  //! the cache file either holds a native index (see ams::KNNIndex),
+  //! which runs on the host only, or a FAISS index
   HDCache(const std::string &cache_path,
           bool use_device,
           const AMSUQPolicy uqPolicy,
           int knbrs,
           TypeInValue threshold = 0.5)
-      : m_index(load_cache(cache_path)),
-        m_dim(m_index->d),
+      : m_dim(0),
         m_use_random(false),
         m_knbrs(knbrs),
         m_policy(uqPolicy),
@@ -121,34 +180,29 @@ public:
   {
     defaultRes =
         (m_use_device) ? AMSResourceType::DEVICE : AMSResourceType::HOST;
-#ifdef __ENABLE_CUDA__
-    // Copy index to device side
-    if (use_device) {
-      faiss::gpu::GpuClonerOptions copyOptions;
-      faiss::gpu::ToGpuCloner cloner(&res, 0, copyOptions);
-      m_index = cloner.clone_Index(m_index);
-    }
-#endif
-    print();
-  }
+    if (ams::KNNIndex::is_native(cache_path)) {
+      CFATAL(UQModule,
+             use_device,
+             "The native kNN index of %s is not supported on the device",
+             cache_path.c_str())
+      m_knn = acquire_native(cache_path);
+      CFATAL(UQModule, !m_knn, "Cannot load %s", cache_path.c_str())
+      m_dim = m_knn->dim();
+    } else {
+#ifdef __ENABLE_FAISS__
+      _share(acquire_cache(cache_path, use_device));
+      CFATAL(UQModule, !m_index, "Cannot load %s", cache_path.c_str())
+      m_dim = m_index->d;
 #else
-  HDCache(const std::string &cache_path,
-          int knbrs,
-          bool use_device,
-          TypeInValue threshold = 0.5)
-      : m_index(nullptr),
-        m_dim(0),
-        m_use_random(true),
-        m_knbrs(knbrs),
-        m_use_device(use_device),
-        acceptable_error(threshold)
-  {
-    defaultRes =
-        (m_use_device) ? AMSResourceType::DEVICE : AMSResourceType::HOST;
-    WARNING(UQModule, "Ignoring cache path because FAISS is not available")
+      FATAL(UQModule,
+            "%s is not a native kNN index and FAISS is not available",
+            cache_path.c_str())
+#endif
+    }
+    m_path = cache_path;
+    m_shared = true;
     print();
   }
-#endif
 
   //! ------------------------------------------------------------------------
   //! simple queries
@@ -165,6 +219,7 @@ public:
 
   inline bool has_index() const
   {
+    if (m_knn) return true;
 #ifdef __ENABLE_FAISS__
     if (!m_use_random) return m_index != nullptr && m_index->is_trained;
 #endif
@@ -173,32 +228,392 @@ public:
 
   inline size_t count() const
   {
+    if (m_use_random) return 0;
+    std::shared_lock<std::shared_timed_mutex> lock(m_mtx);
+    return _count();
+  }
+
+  inline uint8_t dim() const { return m_dim; }
+
+  inline bool is_random() const { return m_use_random; }
+
+  /** @brief Changes whenever points are added, so callers can tell whether
+   * distances they computed earlier may have decreased since */
+  inline uint64_t version() const
+  {
+    return m_version.load(std::memory_order_acquire);
+  }
+
+  /** @brief The threshold evaluations compare the neighbor distances with */
+  inline TypeValue get_threshold() const
+  {
+    return acceptable_error.load(std::memory_order_relaxed);
+  }
+
+  /** @brief Sets the threshold of subsequent evaluations */
+  inline void set_threshold(TypeValue threshold)
+  {
+    acceptable_error.store(threshold, std::memory_order_relaxed);
+  }
+
+  /** @brief Sets the number of points every task of a host search
+   * processes. When 0 it depends on the number of points and threads */
+  inline void set_search_chunk(size_t points)
+  {
+    m_search_chunk.store(points, std::memory_order_relaxed);
+  }
+
+  //! the FAISS index factory string of the indices train creates, such as
+  //! "IVF4096,Flat" (the default), "HNSW32" or "Flat"
+  inline void set_index_key(const std::string &key)
+  {
+#ifdef __ENABLE_FAISS__
+    index_key = key;
+#endif
+  }
+
+  inline const std::string &get_search_params() const
+  {
+    return m_search_params;
+  }
+
+  //! set the search parameters of a FAISS index, such as "nprobe=16" for
+  //! IVF or "efSearch=64" for HNSW indices (see faiss::ParameterSpace).
+  //! Caches sharing an index share its search parameters as well. The
+  //! native index has no parameters.
+  inline void set_search_params(const std::string &params)
+  {
+    set_index_options(params, m_memory_budget);
+  }
+
+  //! limit the memory of a FAISS index to 'budget' bytes, no limit when 0.
+  //! Larger indices are compressed (see compress_index).
+  inline void set_memory_budget(size_t budget)
+  {
+    set_index_options(m_search_params, budget);
+  }
+
+  //! set the search parameters and the memory budget of a FAISS index at
+  //! once. Caches loading the same file with the same budget keep sharing
+  //! it, the search parameters of the shared index are changed in place.
+  //! Indices are compressed on the host, so the budget does not apply to
+  //! indices built on the device.
+  void set_index_options(const std::string &params, size_t budget)
+  {
+    if (m_use_random || m_knn) {
+      CWARNING(UQModule,
+               !params.empty() || budget > 0,
+               "Search parameters and memory budgets only apply to FAISS "
+               "indices, ignoring")
+      return;
+    }
+#ifdef __ENABLE_FAISS__
+    std::unique_lock<std::shared_timed_mutex> lock(m_mtx);
+    if (m_shared) {
+      if (budget != m_memory_budget) {
+        _share(acquire_cache(m_path, m_use_device, budget));
+        CFATAL(UQModule, !m_index, "Cannot load %s", m_path.c_str())
+      }
+      std::unique_lock<std::shared_timed_mutex> index_lock(
+          m_shared_index->mtx);
+      _apply_search_params(m_index, params, m_use_device);
+    } else if (m_index != nullptr) {
+      Index *compressed = m_use_device ? nullptr : compress_index(m_index, budget);
+      if (compressed) {
+        m_owner.reset(compressed);
+        m_index = compressed;
+      }
+      _apply_search_params(m_index, params, m_use_device);
+    }
+    m_search_params = params;
+    m_memory_budget = budget;
+    DBG(UQModule,
+        "HDCache searches with '%s' within %ld bytes",
+        params.c_str(),
+        budget);
+#endif
+  }
+
+  //! the memory the index uses in bytes, 0 when it cannot be measured
+  inline size_t footprint() const
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(m_mtx);
+    if (m_knn) return m_knn->count() * m_knn->dim() * sizeof(TypeValue);
 #ifdef __ENABLE_FAISS__
-    if (!m_use_random) return m_index->ntotal;
+    if (m_index != nullptr && !m_use_device) return index_footprint(m_index);
 #endif
     return 0;
   }
 
-  inline uint8_t dim() const { return m_dim; }
+  //! the memory a host FAISS index uses in bytes. IVF and flat indices
+  //! are measured from their codes, other ones by serializing them.
+  static size_t index_footprint(const Index *index)
+  {
+#ifdef __ENABLE_FAISS__
+    if (auto ivf = dynamic_cast<const faiss::IndexIVF *>(index))
+      return ivf->ntotal * (ivf->code_size + sizeof(TypeIndex)) +
+             index_footprint(ivf->quantizer);
+    if (auto flat = dynamic_cast<const faiss::IndexFlatCodes *>(index))
+      return flat->codes.size();
+    faiss::VectorIOWriter writer;
+    faiss::write_index(index, &writer);
+    return writer.data.size();
+#else
+    return 0;
+#endif
+  }
+
+  //! the FAISS index factory string of the most accurate index holding
+  //! 'ntotal' points of dimension 'dim' within 'budget' bytes. Candidates
+  //! are inverted lists of flat, fp16, 8 bit or 4 bit scalar quantized
+  //! codes, then product quantized codes of the residuals to the list
+  //! centroids with fewer and fewer bytes. Returns the smallest candidate
+  //! when none fits.
+  static std::string compressed_key(size_t ntotal, int dim, size_t budget)
+  {
+    // About 4 sqrt(ntotal) lists, every list stores a centroid and every
+    // point its code and a 64-bit label
+    size_t nlist = 1;
+    while (nlist * nlist < 16 * ntotal && nlist < 65536)
+      nlist *= 2;
+    const double lists = double(nlist) * dim * sizeof(float);
+
+    std::vector<std::pair<std::string, double>> codes = {
+        {"Flat", dim * 4.0},
+        {"SQfp16", dim * 2.0},
+        {"SQ8", dim * 1.0},
+        {"SQ4", (dim + 1) / 2}};
+    for (int m = dim / 2; m >= 1; m--)
+      if (dim % m == 0) codes.emplace_back("PQ" + std::to_string(m), m);
+
+    std::string key;
+    for (const auto &code : codes) {
+      key = "IVF" + std::to_string(nlist) + "," + code.first;
+      if (lists + ntotal * (code.second + sizeof(TypeIndex)) <= budget) break;
+    }
+    return key;
+  }
+
+  //! a copy of a host FAISS index compressed to fit in 'budget' bytes (see
+  //! compressed_key), trained on a sample of its points. Returns null when
+  //! the index already fits or cannot be compressed.
+  static Index *compress_index(const Index *index, size_t budget)
+  {
+#ifdef __ENABLE_FAISS__
+    const size_t current = index_footprint(index);
+    if (budget == 0 || current <= budget || index->ntotal == 0) return nullptr;
+
+    const size_t ntotal = index->ntotal;
+    const int dim = index->d;
+    const std::string key = compressed_key(ntotal, dim, budget);
+    std::unique_ptr<Index> compressed;
+    try {
+      std::vector<TypeValue> points(ntotal * dim);
+      index->reconstruct_n(0, ntotal, points.data());
+      compressed.reset(
+          faiss::index_factory(dim, key.c_str(), index->metric_type));
+      auto source = dynamic_cast<const faiss::IndexIVF *>(index);
+      auto target = dynamic_cast<faiss::IndexIVF *>(compressed.get());
+
+      // Quantizers converge with a few hundred points per centroid
+      const size_t nlist = target ? target->nlist : 1;
+      const size_t nsample =
+          std::min<size_t>(ntotal, std::max<size_t>(1 << 18, 256 * nlist));
+      const size_t stride = ntotal / nsample;
+      std::vector<TypeValue> sample(nsample * dim);
+      for (size_t i = 0; i < nsample; i++)
+        std::copy(&points[i * stride * dim],
+                  &points[(i * stride + 1) * dim],
+                  &sample[i * dim]);
+      compressed->train(nsample, sample.data());
+      compressed->add(ntotal, points.data());
+
+      // Keep probing as many lists as the original index, search
+      // parameters and calibration tune it further
+      if (source && target) target->nprobe = source->nprobe;
+    } catch (const std::exception &e) {
+      WARNING(UQModule,
+              "Cannot compress the index to %s: %s",
+              key.c_str(),
+              e.what())
+      return nullptr;
+    }
+
+    const size_t reduced = index_footprint(compressed.get());
+    (void)reduced;
+    CWARNING(UQModule,
+             reduced > budget,
+             "The smallest index %s uses %ld bytes, more than the budget of "
+             "%ld bytes",
+             key.c_str(),
+             reduced,
+             budget)
+    DBG(UQModule,
+        "Compressed the index from %ld to %ld bytes (%s)",
+        current,
+        reduced,
+        key.c_str())
+    return compressed.release();
+#else
+    return nullptr;
+#endif
+  }
+
+  //! pick the cheapest search parameters of a host FAISS index that find
+  //! at least a fraction 'recall' of the neighbors the most exhaustive
+  //! parameters find, measured on the given sample of queries, and apply
+  //! them. Returns the parameters, empty when there is nothing to tune.
+PERFFASPECT()
+  std::string calibrate(const size_t ndata,
+                        const std::vector<const TypeInValue *> &inputs,
+                        double recall)
+  {
+    std::string chosen;
+#ifdef __ENABLE_FAISS__
+    if (m_use_random || m_knn || m_use_device || ndata == 0) {
+      CWARNING(UQModule,
+               true,
+               "Calibration requires a host FAISS index and queries, ignoring")
+      return chosen;
+    }
+    CFATAL(UQModule, inputs.size() != m_dim, "Mismatch in data dimensionality")
+
+    // Tune a copy, other threads keep searching with the current parameters
+    std::unique_ptr<Index> probe;
+    {
+      std::shared_lock<std::shared_timed_mutex> lock(m_mtx);
+      auto index_lock = _lock_index();
+      probe.reset(_clone_host());
+    }
+    faiss::ParameterSpace space;
+    space.initialize(probe.get());
+    if (space.n_combinations() <= 1) return chosen;
+
+    TypeValue *lin_data = data_handler::linearize_features(ndata, inputs);
+    const size_t knbrs = static_cast<size_t>(m_knbrs);
+    std::vector<TypeValue> gt_dists(ndata * knbrs);
+    std::vector<TypeIndex> gt_idxs(ndata * knbrs);
+    // Parameter values are sorted, the last combination takes the largest
+    // value of every parameter
+    space.set_index_parameters(probe.get(), space.n_combinations() - 1);
+    probe->search(ndata, lin_data, knbrs, gt_dists.data(), gt_idxs.data());
+
+    faiss::IntersectionCriterion criterion(ndata, knbrs);
+    criterion.set_groundtruth(knbrs, gt_dists.data(), gt_idxs.data());
+    faiss::OperatingPoints points;
+    space.explore(probe.get(), ndata, lin_data, criterion, &points);
+    ams::ResourceManager::deallocate(lin_data, defaultRes);
+
+    // Optimal points are sorted by increasing recall and time
+    for (const auto &point : points.optimal_pts) {
+      if (point.perf >= recall) {
+        chosen = point.key;
+        break;
+      }
+    }
+    if (chosen.empty()) {
+      chosen = space.combination_name(space.n_combinations() - 1);
+      WARNING(UQModule,
+              "No search parameters reach a recall of %f, using %s",
+              recall,
+              chosen.c_str())
+    }
+    set_search_params(chosen);
+#endif
+    return chosen;
+  }
 
   //! ------------------------------------------------------------------------
   //! load/save faiss cache
   //! ------------------------------------------------------------------------
-  static inline Index *load_cache(const std::string &filename)
+  //! with 'map', the index file is memory mapped when the index type
+  //! supports it (IVF indices keep their inverted lists in the file), so
+  //! processes of a node loading the same file share its pages. Files of
+  //! mapped indices must be replaced by renaming a new file, not rewritten.
+  static inline Index *load_cache(const std::string &filename,
+                                  bool map = false)
   {
 #ifdef __ENABLE_FAISS__
-    DBG(UQModule, "Loading HDCache: %s", filename.c_str());
+    DBG(UQModule, "Loading HDCache: %s (mapped %d)", filename.c_str(), map);
+    if (map) {
+      try {
+        return faiss::read_index(filename.c_str(), faiss::IO_FLAG_MMAP);
+      } catch (const std::exception &e) {
+        DBG(UQModule,
+            "Cannot map %s, reading it: %s",
+            filename.c_str(),
+            e.what());
+      }
+    }
     return faiss::read_index(filename.c_str());
 #else
     return nullptr;
 #endif
   }
 
-  inline void save_cache(const std::string &filename) const
+  //! load a cache through the registry, caches loading the same file for
+  //! the same device with the same memory budget share it
+  static inline std::shared_ptr<SharedIndex> acquire_cache(
+      const std::string &filename,
+      bool use_device,
+      size_t memory_budget = 0)
   {
 #ifdef __ENABLE_FAISS__
+    std::string options;
+    if (memory_budget > 0) options = "budget=" + std::to_string(memory_budget);
+    return ams::Registry<SharedIndex>::get(
+        filename,
+        "float32",
+        use_device ? "cuda" : "cpu",
+        [&]() {
+          // Compressed and device indices are copies, mapping is useless
+          std::shared_ptr<Index> index(
+              load_cache(filename, !use_device && memory_budget == 0));
+          if (index && memory_budget > 0) {
+            Index *compressed = compress_index(index.get(), memory_budget);
+            if (compressed) index.reset(compressed);
+          }
+#ifdef __ENABLE_CUDA__
+          // Copy index to device side, the index keeps its resources alive
+          if (use_device) {
+            auto res = std::make_shared<faiss::gpu::StandardGpuResources>();
+            faiss::gpu::GpuClonerOptions copyOptions;
+            faiss::gpu::ToGpuCloner cloner(res.get(), 0, copyOptions);
+            index = std::shared_ptr<Index>(cloner.clone_Index(index.get()),
+                                           [res](Index *p) { delete p; });
+          }
+#endif
+          if (!index) return std::shared_ptr<SharedIndex>();
+          auto shared = std::make_shared<SharedIndex>();
+          shared->index = index;
+          return shared;
+        },
+        options);
+#else
+    return nullptr;
+#endif
+  }
+
+  //! load a native index through the registry, mapping its file
+  static inline std::shared_ptr<ams::KNNIndex> acquire_native(
+      const std::string &filename)
+  {
+    return ams::Registry<ams::KNNIndex>::get(filename, "float32", "cpu", [&]() {
+      DBG(UQModule, "Loading native HDCache: %s", filename.c_str());
+      return std::shared_ptr<ams::KNNIndex>(ams::KNNIndex::read(filename));
+    });
+  }
+
+  inline void save_cache(const std::string &filename) const
+  {
     print();
     DBG(UQModule, "Saving HDCache to: %s", filename.c_str());
+    std::shared_lock<std::shared_timed_mutex> lock(m_mtx);
+    if (m_knn) {
+      m_knn->write(filename);
+      return;
+    }
+#ifdef __ENABLE_FAISS__
     faiss::write_index(m_index, filename.c_str());
 #endif
   }
@@ -229,11 +644,34 @@ PERFFASPECT()
     CFATAL(UQModule, inputs.size() != m_dim, "Mismatch in data dimensionality")
     CFATAL(UQModule, !has_index(), "HDCache does not have a valid and trained index!")
 
-    TypeValue *lin_data = data_handler::linearize_features(ndata, inputs);
+    std::vector<const TypeInValue *> cinputs(inputs.begin(), inputs.end());
+    TypeValue *lin_data = data_handler::linearize_features(ndata, cinputs);
     _add(ndata, lin_data);
     ams::ResourceManager::deallocate(lin_data, defaultRes);
   }
 
+  //! add the points that are at least 'radius' away from the indexed ones
+  //! until the index holds 'max_points' points (no limit when 0). Points of
+  //! the same call are not compared with each other. Only supports host
+  //! resident data. Returns the number of points added.
+PERFFASPECT()
+  size_t add(const size_t ndata,
+             const std::vector<const TypeInValue *> &inputs,
+             double radius,
+             size_t max_points = 0)
+  {
+    if (m_use_random || ndata == 0) return 0;
+
+    CFATAL(UQModule, inputs.size() != m_dim, "Mismatch in data dimensionality")
+    CFATAL(UQModule, !has_index(), "HDCache does not have a valid and trained index!")
+
+    TypeValue *lin_data = data_handler::linearize_features(ndata, inputs);
+    size_t added = _add_filtered(ndata, lin_data, radius, max_points);
+    ams::ResourceManager::deallocate(lin_data, defaultRes);
+    DBG(UQModule, "Added %ld of %ld points to HDCache", added, ndata);
+    return added;
+  }
+
   //! -----------------------------------------------------------------------
   //! train a faiss cache
   //! -----------------------------------------------------------------------
@@ -255,7 +693,8 @@ PERFFASPECT()
   void train(const size_t ndata, const std::vector<TypeInValue *> &inputs)
   {
     if (m_use_random) return;
-    TypeValue *lin_data = data_handler::linearize_features(ndata, inputs);
+    std::vector<const TypeInValue *> cinputs(inputs.begin(), inputs.end());
+    TypeValue *lin_data = data_handler::linearize_features(ndata, cinputs);
     _train(ndata, lin_data);
     ams::ResourceManager::deallocate(lin_data, defaultRes);
   }
@@ -283,39 +722,449 @@ PERFFASPECT()
     if (m_use_random) {
       _evaluate(ndata, is_acceptable);
     } else {
+      std::shared_lock<std::shared_timed_mutex> lock(m_mtx);
+      auto index_lock = _lock_index();
       _evaluate(ndata, data, is_acceptable);
     }
 
   }
 
   //! train on data that comes separate features (a vector of pointers)
+  //! when 'metric' is not null it receives the distance every decision
+  //! compared with the threshold (see supports_metric)
 PERFFASPECT()
   void evaluate(const size_t ndata,
                 const std::vector<const TypeInValue *> &inputs,
-                bool *is_acceptable) const
+                bool *is_acceptable,
+                double *metric = nullptr) const
   {
 
     CFATAL(UQModule, !has_index(), "HDCache does not have a valid and trained index!")
     DBG(UQModule, "Evaluating %ld %ld points using HDCache configured with %d neighbors, %f threshold, %d policy",
-        ndata, inputs.size(), m_knbrs, acceptable_error, m_policy);
+        ndata, inputs.size(), m_knbrs, get_threshold(), m_policy);
     CFATAL(UQModule, ((!m_use_random) && inputs.size() != m_dim), "Mismatch in data dimensionality!")
 
     if (m_use_random) {
       _evaluate(ndata, is_acceptable);
-    } else {
+    } else if (ams::ResourceManager::is_on_device(inputs[0])) {
       TypeValue *lin_data = data_handler::linearize_features(ndata, inputs);
-      _evaluate(ndata, lin_data, is_acceptable);
+      std::shared_lock<std::shared_timed_mutex> lock(m_mtx);
+      auto index_lock = _lock_index();
+      _evaluate(ndata, lin_data, is_acceptable, metric);
       ams::ResourceManager::deallocate(lin_data, defaultRes);
+    } else {
+      TypeValue *lin_data = _query_buffer(ndata * m_dim);
+      data_handler::linearize_features(ndata, inputs, lin_data);
+      std::shared_lock<std::shared_timed_mutex> lock(m_mtx);
+      auto index_lock = _lock_index();
+      _evaluate(ndata, lin_data, is_acceptable, metric);
     }
   }
 
-private:
+  //! whether evaluate can report the distances behind its decisions. They
+  //! are squared L2 distances (mean of the k nearest neighbors for
+  //! FAISSMean, distance to the k-th neighbor for FAISSMax), available for
+  //! host resident L2 indices only.
+  inline bool supports_metric() const
+  {
+    bool l2 = (m_knn != nullptr);
 #ifdef __ENABLE_FAISS__
+    l2 = l2 || (m_index != nullptr && m_index->metric_type == faiss::METRIC_L2);
+#endif
+    return l2 && !m_use_random && !m_use_device &&
+           (m_policy == AMSUQPolicy::FAISSMean ||
+            m_policy == AMSUQPolicy::FAISSMax);
+  }
+
+  inline AMSUQPolicy get_policy() const { return m_policy; }
+
+  //! run searches on random points so that the first evaluations do not
+  //! pay for allocator growth and lazy initialization of the index
+PERFFASPECT()
+  void warmup(const std::vector<long> &batchSizes) const
+  {
+    if (m_use_random || !has_index()) return;
+    for (auto batch : batchSizes) {
+      if (batch <= 0) continue;
+      const size_t numValues = batch * m_dim;
+      TypeInValue *points = ams::ResourceManager::allocate<TypeInValue>(
+          numValues, AMSResourceType::HOST);
+      for (size_t i = 0; i < numValues; i++)
+        points[i] = static_cast<TypeInValue>(rand()) / RAND_MAX;
+      TypeInValue *data = points;
+      if (defaultRes != AMSResourceType::HOST) {
+        data = ams::ResourceManager::allocate<TypeInValue>(numValues,
+                                                           defaultRes);
+        ams::ResourceManager::copy(points,
+                                   data,
+                                   numValues * sizeof(TypeInValue));
+      }
+      bool *predicate = ams::ResourceManager::allocate<bool>(batch, defaultRes);
+      std::vector<const TypeInValue *> inputs;
+      for (int d = 0; d < m_dim; d++)
+        inputs.push_back(&data[d * batch]);
+      evaluate(batch, inputs, predicate);
+      ams::ResourceManager::deallocate(predicate, defaultRes);
+      if (data != points) ams::ResourceManager::deallocate(data, defaultRes);
+      ams::ResourceManager::deallocate(points, AMSResourceType::HOST);
+      DBG(UQModule, "Warmed up HDCache with %ld points", batch);
+    }
+  }
+
+private:
   //! ------------------------------------------------------------------------
-  //! core faiss functionality.
+  //! core index functionality, FAISS or the native engine.
   //! ------------------------------------------------------------------------
 
-  inline uint8_t _dim() const { return (m_index != nullptr) ? m_index->d : 0; }
+  //! indices shared through the registry are copied before we modify them.
+  //! Requires m_mtx to be held exclusively.
+  void _make_private()
+  {
+    if (!m_shared) return;
+    DBG(UQModule, "Copying the shared index before modifying it");
+    m_shared = false;
+    if (m_knn) {
+      m_knn = std::make_shared<ams::KNNIndex>(*m_knn);
+      return;
+    }
+#ifdef __ENABLE_FAISS__
+    auto index_lock = _lock_index();
+    Index *copy = nullptr;
+#ifdef __ENABLE_CUDA__
+    if (m_use_device) {
+      std::unique_ptr<Index> host(faiss::gpu::index_gpu_to_cpu(m_index));
+      faiss::gpu::ToGpuCloner cloner(&res, 0, copyOptions);
+      copy = cloner.clone_Index(host.get());
+    } else
+#endif
+      copy = _clone_host();
+    index_lock = std::shared_lock<std::shared_timed_mutex>();
+    m_shared_index.reset();
+    m_owner.reset(copy);
+    m_index = copy;
+#endif
+  }
+
+  //! use an index shared through the registry. Requires m_mtx to be held
+  //! exclusively or the cache not to be in use yet.
+  void _share(std::shared_ptr<SharedIndex> shared)
+  {
+    m_shared_index = std::move(shared);
+    m_shared = true;
+    if (m_shared_index) {
+      m_owner = std::shared_ptr<Index>(m_shared_index,
+                                       m_shared_index->index.get());
+    } else {
+      m_owner.reset();
+    }
+    m_index = m_owner.get();
+  }
+
+  //! lock the shared FAISS index, so that its search parameters do not
+  //! change while searching or copying it. Does not lock private indices.
+  //! Requires m_mtx to be held.
+  std::shared_lock<std::shared_timed_mutex> _lock_index() const
+  {
+    if (!m_shared_index) return std::shared_lock<std::shared_timed_mutex>();
+    return std::shared_lock<std::shared_timed_mutex>(m_shared_index->mtx);
+  }
+
+#ifdef __ENABLE_FAISS__
+  //! copy the host index. Mapped inverted lists cannot be copied, the file
+  //! is then read again into memory.
+  Index *_clone_host() const
+  {
+    try {
+      return faiss::clone_index(m_index);
+    } catch (const std::exception &e) {
+      CFATAL(UQModule,
+             m_path.empty(),
+             "Cannot copy the index: %s",
+             e.what())
+      DBG(UQModule, "Reading %s to copy its index", m_path.c_str());
+      Index *copy = load_cache(m_path);
+      _apply_search_params(copy, m_search_params, false);
+      return copy;
+    }
+  }
+#endif
+
+  //! a buffer of the calling thread for linearized host queries, reused
+  //! across evaluations so that they do not allocate
+  static inline TypeValue *_query_buffer(size_t nvalues)
+  {
+    static thread_local std::vector<TypeValue> buffer;
+    if (buffer.size() < nvalues) buffer.resize(nvalues);
+    return buffer.data();
+  }
+
+  //! apply search parameters to a FAISS index
+  static inline void _apply_search_params(Index *index,
+                                          const std::string &params,
+                                          bool use_device)
+  {
+#ifdef __ENABLE_FAISS__
+    if (index == nullptr || params.empty()) return;
+    try {
+#ifdef __ENABLE_CUDA__
+      if (use_device)
+        faiss::gpu::GpuParameterSpace().set_index_parameters(index,
+                                                             params.c_str());
+      else
+#endif
+        faiss::ParameterSpace().set_index_parameters(index, params.c_str());
+    } catch (const std::exception &e) {
+      FATAL(UQModule,
+            "Cannot set search parameters '%s': %s",
+            params.c_str(),
+            e.what())
+    }
+#endif
+  }
+
+  //! the number of indexed points. Requires m_mtx to be held.
+  inline size_t _count() const
+  {
+    if (m_knn) return m_knn->count();
+#ifdef __ENABLE_FAISS__
+    if (m_index != nullptr) return m_index->ntotal;
+#endif
+    return 0;
+  }
+
+  //! find the k nearest neighbors of linearized points. Requires m_mtx to
+  //! be held. Callers that already search in parallel pass parallel = false
+  //! so that the index does not spawn threads of its own.
+PERFFASPECT()
+  inline void _search(const size_t ndata,
+                      const TypeValue *data,
+                      const size_t knbrs,
+                      TypeValue *kdists,
+                      TypeIndex *kidxs,
+                      bool parallel = true) const
+  {
+    if (m_knn) {
+      m_knn->search(ndata,
+                    data,
+                    knbrs,
+                    kdists,
+                    reinterpret_cast<ams::KNNIndex::Label *>(kidxs),
+                    parallel);
+      return;
+    }
+#ifdef __ENABLE_FAISS__
+#ifdef _OPENMP
+    const int ompThreads = omp_get_max_threads();
+    if (!parallel) omp_set_num_threads(1);
+#endif
+    // query faiss
+    // TODO: This is a HACK. When searching more than 65535
+    // items in the GPU case, faiss is throwing an exception.
+    const unsigned int MAGIC_NUMBER = 65535;
+    for (int start = 0; start < ndata; start += MAGIC_NUMBER) {
+      unsigned int nElems =
+          ((ndata - start) < MAGIC_NUMBER) ? ndata - start : MAGIC_NUMBER;
+      m_index->search(
+          nElems, &data[start * m_dim], knbrs, &kdists[start*knbrs], &kidxs[start*knbrs]);
+    }
+#ifdef _OPENMP
+    if (!parallel) omp_set_num_threads(ompThreads);
+#endif
+#endif
+  }
+
+  //! mean of the k neighbor distances of every point against the
+  //! threshold. A positive K fixes k at compile time, so that the row
+  //! reductions unroll and vectorize.
+  template <int K, bool WithMetric>
+  static inline void _mean_predicate(const size_t ndata,
+                                     const TypeValue *kdists,
+                                     const size_t knbrs,
+                                     const TypeValue threshold,
+                                     bool *is_acceptable,
+                                     double *metric)
+  {
+    const size_t k = (K > 0) ? K : knbrs;
+    const TypeValue ook = 1.0 / TypeValue(k);
+    for (size_t i = 0; i < ndata; ++i) {
+      const TypeValue *row = kdists + i * k;
+      double sum = 0;
+      for (size_t j = 0; j < k; ++j)
+        sum += row[j];
+      const TypeValue mean = ook * static_cast<TypeValue>(sum);
+      is_acceptable[i] = mean < threshold;
+      if (WithMetric) metric[i] = mean;
+    }
+  }
+
+  //! distance to the furthest of the k neighbors of every point against
+  //! the threshold
+  template <bool WithMetric>
+  static inline void _max_predicate(const size_t ndata,
+                                    const TypeValue *kdists,
+                                    const size_t knbrs,
+                                    const TypeValue threshold,
+                                    bool *is_acceptable,
+                                    double *metric)
+  {
+    const TypeValue *last = kdists + knbrs - 1;
+    for (size_t i = 0; i < ndata; ++i) {
+      const TypeValue dist = last[i * knbrs];
+      is_acceptable[i] = dist < threshold;
+      if (WithMetric) metric[i] = dist;
+    }
+  }
+
+  template <int K>
+  static inline void _mean_predicate(const size_t ndata,
+                                     const TypeValue *kdists,
+                                     const size_t knbrs,
+                                     const TypeValue threshold,
+                                     bool *is_acceptable,
+                                     double *metric)
+  {
+    if (metric)
+      _mean_predicate<K, true>(
+          ndata, kdists, knbrs, threshold, is_acceptable, metric);
+    else
+      _mean_predicate<K, false>(
+          ndata, kdists, knbrs, threshold, is_acceptable, metric);
+  }
+
+  //! compare the neighbor distances of host resident points with the
+  //! threshold, with kernels specialized for the policy and the common
+  //! numbers of neighbors
+  inline void _predicate(const size_t ndata,
+                         const TypeValue *kdists,
+                         const size_t knbrs,
+                         const TypeValue threshold,
+                         bool *is_acceptable,
+                         double *metric) const
+  {
+    if (m_policy == AMSUQPolicy::FAISSMax) {
+      if (metric)
+        _max_predicate<true>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+      else
+        _max_predicate<false>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+      return;
+    }
+    if (m_policy != AMSUQPolicy::FAISSMean) return;
+
+    switch (knbrs) {
+      case 1:
+        _mean_predicate<1>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+        break;
+      case 2:
+        _mean_predicate<2>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+        break;
+      case 4:
+        _mean_predicate<4>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+        break;
+      case 5:
+        _mean_predicate<5>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+        break;
+      case 8:
+        _mean_predicate<8>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+        break;
+      case 10:
+        _mean_predicate<10>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+        break;
+      case 16:
+        _mean_predicate<16>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+        break;
+      default:
+        _mean_predicate<0>(
+            ndata, kdists, knbrs, threshold, is_acceptable, metric);
+    }
+  }
+
+  //! evaluate host resident points in chunks on the shared thread pool.
+  //! Every chunk searches into the buffers of its thread and computes its
+  //! predicate right away, or lets the native index decide it with early
+  //! termination. Requires m_mtx to be held.
+PERFFASPECT()
+  void _evaluate_host(const size_t ndata,
+                      const TypeValue *data,
+                      bool *is_acceptable,
+                      double *metric) const
+  {
+    const size_t knbrs = static_cast<size_t>(m_knbrs);
+    const TypeValue threshold = get_threshold();
+    ams::ThreadPool &threads = ams::ThreadPool::shared();
+
+    // By default every thread gets a few chunks to balance the load, large
+    // enough to amortize the cost of a search call
+    size_t chunk = m_search_chunk.load(std::memory_order_relaxed);
+    if (chunk == 0) {
+      const size_t numChunks = 4 * (threads.size() + 1);
+      chunk = std::max<size_t>(1024, (ndata + numChunks - 1) / numChunks);
+    }
+    const bool parallel = ndata > chunk;
+
+    // The native index decides without computing the neighbors when the
+    // distances are not requested, so queries stop once they are accepted
+    const bool decide = m_knn && metric == nullptr &&
+                        (m_policy == AMSUQPolicy::FAISSMean ||
+                         m_policy == AMSUQPolicy::FAISSMax);
+
+    auto run = [&](size_t begin, size_t end) {
+      static thread_local SearchBuffers buffers;
+      const size_t n = end - begin;
+      if (decide) {
+        m_knn->decide(n,
+                      &data[begin * m_dim],
+                      knbrs,
+                      threshold,
+                      m_policy == AMSUQPolicy::FAISSMean,
+                      &is_acceptable[begin],
+                      !parallel);
+        return;
+      }
+      if (buffers.kdists.size() < n * knbrs) {
+        buffers.kdists.resize(n * knbrs);
+        buffers.kidxs.resize(n * knbrs);
+      }
+      _search(n,
+              &data[begin * m_dim],
+              knbrs,
+              buffers.kdists.data(),
+              buffers.kidxs.data(),
+              !parallel);
+      _predicate(n,
+                 buffers.kdists.data(),
+                 knbrs,
+                 threshold,
+                 &is_acceptable[begin],
+                 metric ? &metric[begin] : nullptr);
+    };
+
+    if (parallel)
+      threads.parallel_for(ndata, chunk, run);
+    else
+      run(0, ndata);
+  }
+
+  //! append linearized points. Requires m_mtx to be held exclusively.
+  inline void _insert(const size_t ndata, const TypeValue *data)
+  {
+    _make_private();
+    if (m_knn)
+      m_knn->add(ndata, data);
+#ifdef __ENABLE_FAISS__
+    else
+      m_index->add(ndata, data);
+#endif
+    m_version.fetch_add(1, std::memory_order_release);
+  }
 
   //! add points to index when  (data type = TypeValue)
   template <typename T,
@@ -323,7 +1172,44 @@ private:
 PERFFASPECT()
   inline void _add(const size_t ndata, const T *data)
   {
-    m_index->add(ndata, data);
+    std::unique_lock<std::shared_timed_mutex> lock(m_mtx);
+    _insert(ndata, data);
+  }
+
+  //! add the points of 'data' far enough from the index, 'data' is
+  //! compacted in place
+PERFFASPECT()
+  size_t _add_filtered(const size_t ndata,
+                       TypeValue *data,
+                       double radius,
+                       size_t max_points)
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(m_mtx);
+    const size_t ntotal = _count();
+    size_t room = ndata;
+    if (max_points > 0) room = (ntotal < max_points) ? max_points - ntotal : 0;
+
+    size_t n = std::min(ndata, room);
+    if (radius > 0 && ntotal > 0 && n > 0) {
+      // Searches report squared L2 distances
+      const TypeValue radius2 = radius * radius;
+      std::vector<TypeValue> dists(ndata);
+      std::vector<TypeIndex> idxs(ndata);
+      {
+        auto index_lock = _lock_index();
+        _search(ndata, data, 1, dists.data(), idxs.data());
+      }
+      n = 0;
+      for (size_t i = 0; i < ndata && n < room; i++) {
+        if (dists[i] < radius2) continue;
+        if (n != i)
+          std::copy(&data[i * m_dim], &data[(i + 1) * m_dim], &data[n * m_dim]);
+        n++;
+      }
+    }
+    if (n == 0) return 0;
+    _insert(n, data);
+    return n;
   }
 
   //! add points to index when (data type != TypeValue)
@@ -332,9 +1218,8 @@ PERFFASPECT()
 PERFFASPECT()
   inline void _add(const size_t ndata, const T *data)
   {
-    TypeValue *vdata = data_handler::cast_to_typevalue(ndata, data);
-    _add(ndata, vdata);
-    delete[] vdata;
+    std::vector<TypeValue> vdata(data, data + ndata * m_dim);
+    _add(ndata, vdata.data());
   }
 
 
@@ -345,6 +1230,7 @@ PERFFASPECT()
   inline void _train(const size_t ndata, const T *data)
   {
 
+#ifdef __ENABLE_FAISS__
     if (m_index != nullptr && m_index->is_trained)
       throw std::invalid_argument(
           "!");
@@ -353,12 +1239,22 @@ PERFFASPECT()
         (m_index != nullptr && m_index->is_trained),
         "Trying to re-train an already trained index")
 
-    m_index = faiss::index_factory(m_dim, index_key);
+    std::unique_lock<std::shared_timed_mutex> lock(m_mtx);
+    m_owner.reset(faiss::index_factory(m_dim, index_key.c_str()));
+    _apply_search_params(m_owner.get(), m_search_params, m_use_device);
+    m_shared_index.reset();
+    m_shared = false;
+    m_index = m_owner.get();
     m_index->train(ndata, data);
 
     CFATAL(UQModule,
         ((!m_index->is_trained)),
         "Failed to train index")
+#else
+    // The native index is exhaustive and does not need any training
+    std::unique_lock<std::shared_timed_mutex> lock(m_mtx);
+    if (!m_knn) m_knn = std::make_shared<ams::KNNIndex>(m_dim);
+#endif
   }
 
   //! train an index when (data type != TypeValue)
@@ -367,9 +1263,8 @@ PERFFASPECT()
 PERFFASPECT()
   inline void _train(const size_t ndata, const T *data)
   {
-    TypeValue *vdata = data_handler::cast_to_typevalue(ndata, data);
-    _train(ndata, vdata);
-    delete[] vdata;
+    std::vector<TypeValue> vdata(data, data + ndata * m_dim);
+    _train(ndata, vdata.data());
   }
 
   // -------------------------------------------------------------------------
@@ -377,11 +1272,14 @@ PERFFASPECT()
   template <typename T,
             std::enable_if_t<std::is_same<TypeValue, T>::value> * = nullptr>
 PERFFASPECT()
-  void _evaluate(const size_t ndata, T *data, bool *is_acceptable) const
+  void _evaluate(const size_t ndata,
+                 T *data,
+                 bool *is_acceptable,
+                 double *metric = nullptr) const
   {
 
     const size_t knbrs = static_cast<size_t>(m_knbrs);
-    static const TypeValue ook = 1.0 / TypeValue(knbrs);
+    const TypeValue threshold = get_threshold();
 
     const bool input_on_device = ams::ResourceManager::is_on_device(data);
     const bool output_on_device =
@@ -394,45 +1292,24 @@ PERFFASPECT()
                         input_on_device, output_on_device)
     }
 
+    if (defaultRes == AMSResourceType::HOST) {
+      CFATAL(UQModule, m_policy==AMSUQPolicy::DeltaUQ, "DeltaUQ is not supported yet");
+      _evaluate_host(ndata, data, is_acceptable, metric);
+      return;
+    }
+
+    CFATAL(UQModule, (m_policy==AMSUQPolicy::DeltaUQ) || (m_policy==AMSUQPolicy::FAISSMax),
+        "DeltaUQ is not supported yet");
+
     TypeValue *kdists =
         ams::ResourceManager::allocate<TypeValue>(ndata * knbrs, defaultRes);
     TypeIndex *kidxs =
         ams::ResourceManager::allocate<TypeIndex>(ndata * knbrs, defaultRes);
 
-    // query faiss
-    // TODO: This is a HACK. When searching more than 65535
-    // items in the GPU case, faiss is throwing an exception.
-    const unsigned int MAGIC_NUMBER = 65535;
-    for (int start = 0; start < ndata; start += MAGIC_NUMBER) {
-      unsigned int nElems =
-          ((ndata - start) < MAGIC_NUMBER) ? ndata - start : MAGIC_NUMBER;
-      m_index->search(
-          nElems, &data[start], knbrs, &kdists[start*knbrs], &kidxs[start*knbrs]);
-    }
-
-    // compute means
-    if (defaultRes == AMSResourceType::HOST) {
-      TypeValue total_dist = 0;
-      for (size_t i = 0; i < ndata; ++i) {
-        CFATAL(UQModule, m_policy==AMSUQPolicy::DeltaUQ, "DeltaUQ is not supported yet");
-        if ( m_policy == AMSUQPolicy::FAISSMean ) {
-          total_dist =
-              std::accumulate(kdists + i * knbrs, kdists + (i + 1) * knbrs, 0.);
-          is_acceptable[i] = (ook * total_dist) < acceptable_error;
-        }
-        else if ( m_policy == AMSUQPolicy::FAISSMax ) {
-          // Take the furtherst cluster as the distance metric
-          total_dist = kdists[i*knbrs + knbrs -1];
-          is_acceptable[i] = (total_dist) < acceptable_error;
-        }
-      }
-    } else {
-      CFATAL(UQModule, (m_policy==AMSUQPolicy::DeltaUQ) || (m_policy==AMSUQPolicy::FAISSMax),
-          "DeltaUQ is not supported yet");
+    _search(ndata, data, knbrs, kdists, kidxs);
 
-      ams::Device::computePredicate(
-          kdists, is_acceptable, ndata, knbrs, acceptable_error);
-    }
+    ams::Device::computePredicate(
+        kdists, is_acceptable, ndata, knbrs, threshold);
 
     ams::ResourceManager::deallocate(kdists, defaultRes);
     ams::ResourceManager::deallocate(kidxs, defaultRes);
@@ -441,37 +1318,18 @@ PERFFASPECT()
   //! evaluate cache uncertainty when (data type != TypeValue)
   template <typename T,
             std::enable_if_t<!std::is_same<TypeValue, T>::value> * = nullptr>
-  inline void _evaluate(const size_t ndata, T *data, bool *is_acceptable) const
-  {
-    TypeValue *vdata = data_handler::cast_to_typevalue(ndata, data);
-    _evaluate(ndata, data, is_acceptable);
-    delete[] vdata;
-  }
-
-#else
-  // -------------------------------------------------------------------------
-  // fucntionality for randomized cache
-  // -------------------------------------------------------------------------
-  inline uint8_t _dim() const { return 0; }
-
-  template <typename T>
-PERFFASPECT()
-  inline void _add(const size_t, const T *)
-  {
-  }
-
-  template <typename T>
-PERFFASPECT()
-  inline void _train(const size_t, const T *)
+  inline void _evaluate(const size_t ndata,
+                        T *data,
+                        bool *is_acceptable,
+                        double *metric = nullptr) const
   {
+    TypeValue *vdata = _query_buffer(ndata * m_dim);
+    std::transform(data, data + ndata * m_dim, vdata, [](const T &v) {
+      return static_cast<TypeValue>(v);
+    });
+    _evaluate(ndata, vdata, is_acceptable, metric);
   }
 
-  template <typename T>
-PERFFASPECT()
-  inline void _evaluate(const size_t, T *, bool *) const
-  {
-  }
-#endif
 PERFFASPECT()
   inline void _evaluate(const size_t ndata, bool *is_acceptable) const
   {
@@ -480,10 +1338,10 @@ PERFFASPECT()
 
     if (data_on_device) {
 #ifdef __ENABLE_CUDA__
-      random_uq_device<<<1, 1>>>(is_acceptable, ndata, acceptable_error);
+      random_uq_device<<<1, 1>>>(is_acceptable, ndata, get_threshold());
 #endif
     } else {
-      random_uq_host(is_acceptable, ndata, acceptable_error);
+      random_uq_host(is_acceptable, ndata, get_threshold());
     }
   }
   // -------------------------------------------------------------------------
@@ -0,0 +1,498 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#ifndef __AMS_KNN_HPP__
+#define __AMS_KNN_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "wf/debug.h"
+#include "wf/thread_pool.hpp"
+
+namespace ams
+{
+/**
+ * @brief A brute force k nearest neighbor index computing exact squared L2
+ * distances on the host, an alternative to FAISS flat indices.
+ *
+ * @details Points are stored per dimension (structure of arrays), so the
+ * distance kernel computes many points at once with AVX-512 or AVX2 when
+ * the compiler targets them, and with a loop the compiler vectorizes
+ * otherwise. Searches process blocks of queries against blocks of points
+ * that stay in cache while every query of the block visits them, keep the k
+ * nearest points of every query in a max heap and run in parallel over the
+ * queries on the shared thread pool (see ThreadPool::shared).
+ *
+ * Indices are stored in a binary file made of a 64 byte header:
+ *  - the 8 byte magic "AMSKNN2\0",
+ *  - the number of points as int64,
+ *  - the dimension as int32, followed by 4 bytes of padding,
+ *  - the stride as int64, followed by zeros,
+ * and of the coordinates as float32 in the layout of the memory (see
+ * 'coords'). Such files are memory mapped read-only and shared: every
+ * process of a node mapping the same file uses the same pages of the page
+ * cache. Mapped indices are copied to memory once points are added.
+ * Files starting with "AMSKNN1\0" store the coordinates point after point
+ * after the first 24 bytes of the header, they are read into memory.
+ */
+class KNNIndex
+{
+public:
+  using Label = int64_t;
+
+private:
+  /** @brief The first bytes of index files, including the terminator */
+  static const char *magic() { return "AMSKNN2"; }
+
+  /** @brief The first bytes of index files storing points one after the
+   * other */
+  static const char *rowsMagic() { return "AMSKNN1"; }
+
+  enum : size_t {
+    /** @brief Length of the magic */
+    magicSize = 8,
+    /** @brief Coordinates start at this offset of index files */
+    headerSize = 64,
+    /** @brief Points are padded to a multiple of the widest vector */
+    lanes = 16,
+    /** @brief Number of points whose distances a query computes at once */
+    pointBlock = 4096,
+    /** @brief Number of queries visiting a block of points in a row */
+    queryBlock = 16
+  };
+
+  int d;
+  size_t ntotal;
+  /** @brief The distance between two dimensions in 'coords' */
+  size_t stride;
+  /** @brief Coordinate 'k' of point 'i' is at coords[k * stride + i].
+   * Padding points are at infinity, so they are never selected */
+  std::vector<float> coords;
+  /** @brief The mapped index file holding the coordinates instead of
+   * 'coords'. Copies of the index share it */
+  std::shared_ptr<const void> mapping;
+  const float *mapped = nullptr;
+
+  static size_t padded(size_t n) { return (n + lanes - 1) / lanes * lanes; }
+
+  /** @brief The coordinates, mapped or in memory */
+  const float *base() const { return mapping ? mapped : coords.data(); }
+
+  /** @brief Makes room for 'capacity' points, keeping the current ones */
+  void reserve(size_t capacity)
+  {
+    if (mapping) {
+      coords.assign(mapped, mapped + stride * d);
+      mapping.reset();
+      mapped = nullptr;
+    }
+    if (capacity <= stride) return;
+    const size_t newStride = padded(std::max(capacity, 2 * stride));
+    std::vector<float> grown(newStride * d,
+                             std::numeric_limits<float>::infinity());
+    for (int k = 0; k < d; k++)
+      std::copy(&coords[k * stride],
+                &coords[k * stride] + ntotal,
+                &grown[k * newStride]);
+    coords.swap(grown);
+    stride = newStride;
+  }
+
+  /** @brief Squared distances of a query to 'count' consecutive points
+   * starting at 'begin'. 'count' is a multiple of 'lanes' */
+  void distances(const float *query,
+                 size_t begin,
+                 size_t count,
+                 float *out) const
+  {
+    const float *base = this->base() + begin;
+#if defined(__AVX512F__)
+    for (size_t j = 0; j < count; j += 16) {
+      __m512 acc = _mm512_setzero_ps();
+      for (int k = 0; k < d; k++) {
+        __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(base + k * stride + j),
+                                    _mm512_set1_ps(query[k]));
+        acc = _mm512_fmadd_ps(diff, diff, acc);
+      }
+      _mm512_storeu_ps(out + j, acc);
+    }
+#elif defined(__AVX2__)
+    for (size_t j = 0; j < count; j += 8) {
+      __m256 acc = _mm256_setzero_ps();
+      for (int k = 0; k < d; k++) {
+        __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(base + k * stride + j),
+                                    _mm256_set1_ps(query[k]));
+#if defined(__FMA__)
+        acc = _mm256_fmadd_ps(diff, diff, acc);
+#else
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(diff, diff));
+#endif
+      }
+      _mm256_storeu_ps(out + j, acc);
+    }
+#else
+    std::fill(out, out + count, 0.0f);
+    for (int k = 0; k < d; k++) {
+      const float *x = base + k * stride;
+      const float q = query[k];
+      for (size_t j = 0; j < count; j++) {
+        const float diff = x[j] - q;
+        out[j] += diff * diff;
+      }
+    }
+#endif
+  }
+
+  /** @brief Searches queries [begin, end) */
+  void searchRange(size_t begin,
+                   size_t end,
+                   const float *queries,
+                   int k,
+                   float *outDistances,
+                   Label *outLabels) const
+  {
+    using Entry = std::pair<float, Label>;
+    const Entry empty(std::numeric_limits<float>::infinity(), -1);
+    std::vector<float> dist(pointBlock);
+    std::vector<std::vector<Entry>> heaps(queryBlock);
+
+    for (size_t q0 = begin; q0 < end; q0 += queryBlock) {
+      const size_t nq = std::min<size_t>(queryBlock, end - q0);
+      for (size_t q = 0; q < nq; q++)
+        heaps[q].assign(k, empty);
+
+      for (size_t p0 = 0; p0 < ntotal; p0 += pointBlock) {
+        const size_t np = std::min<size_t>(pointBlock, ntotal - p0);
+        for (size_t q = 0; q < nq; q++) {
+          distances(&queries[(q0 + q) * d], p0, padded(np), dist.data());
+          auto &heap = heaps[q];
+          float worst = heap.front().first;
+          for (size_t j = 0; j < np; j++) {
+            if (!(dist[j] < worst)) continue;
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = Entry(dist[j], static_cast<Label>(p0 + j));
+            std::push_heap(heap.begin(), heap.end());
+            worst = heap.front().first;
+          }
+        }
+      }
+
+      for (size_t q = 0; q < nq; q++) {
+        auto &heap = heaps[q];
+        std::sort_heap(heap.begin(), heap.end());
+        for (int i = 0; i < k; i++) {
+          outDistances[(q0 + q) * k + i] = heap[i].first;
+          outLabels[(q0 + q) * k + i] = heap[i].second;
+        }
+      }
+    }
+  }
+
+  /** @brief Decides queries [begin, end) */
+  void decideRange(size_t begin,
+                   size_t end,
+                   const float *queries,
+                   int k,
+                   float bound,
+                   bool mean,
+                   bool *accept) const
+  {
+    const float ook = 1.0f / float(k);
+    std::vector<float> dist(pointBlock);
+    std::vector<std::vector<float>> heaps(queryBlock);
+    std::vector<double> sums(queryBlock);
+    std::vector<int> counts(queryBlock);
+    std::vector<char> done(queryBlock);
+
+    for (size_t q0 = begin; q0 < end; q0 += queryBlock) {
+      const size_t nq = std::min<size_t>(queryBlock, end - q0);
+      size_t pending = nq;
+      for (size_t q = 0; q < nq; q++) {
+        accept[q0 + q] = false;
+        heaps[q].clear();
+        sums[q] = 0;
+        counts[q] = 0;
+        done[q] = false;
+      }
+
+      // Queries leave the loop once accepted, rejections need all points
+      for (size_t p0 = 0; p0 < ntotal && pending > 0; p0 += pointBlock) {
+        const size_t np = std::min<size_t>(pointBlock, ntotal - p0);
+        for (size_t q = 0; q < nq; q++) {
+          if (done[q]) continue;
+          distances(&queries[(q0 + q) * d], p0, padded(np), dist.data());
+          if (!mean) {
+            // The k-th distance is below the bound once k points are
+            for (size_t j = 0; j < np; j++)
+              counts[q] += dist[j] < bound;
+            done[q] = counts[q] >= k;
+          } else {
+            // The mean of the k nearest points found so far bounds the
+            // final mean from above
+            auto &heap = heaps[q];
+            size_t j = 0;
+            for (; j < np && heap.size() < size_t(k); j++) {
+              heap.push_back(dist[j]);
+              std::push_heap(heap.begin(), heap.end());
+              sums[q] += dist[j];
+            }
+            float worst = heap.front();
+            for (; j < np; j++) {
+              if (!(dist[j] < worst)) continue;
+              sums[q] += double(dist[j]) - double(worst);
+              std::pop_heap(heap.begin(), heap.end());
+              heap.back() = dist[j];
+              std::push_heap(heap.begin(), heap.end());
+              worst = heap.front();
+            }
+            done[q] = heap.size() == size_t(k) &&
+                      ook * static_cast<float>(sums[q]) < bound;
+          }
+          if (done[q]) {
+            accept[q0 + q] = true;
+            pending--;
+          }
+        }
+      }
+    }
+  }
+
+  /** @brief Maps the coordinates of an index file, returns whether it
+   * succeeded */
+  bool map(const std::string &filename, size_t numValues)
+  {
+    const size_t length = headerSize + numValues * sizeof(float);
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) >= length)
+      addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      DBG(KNN, "Cannot map %s, reading it", filename.c_str())
+      return false;
+    }
+    mapping = std::shared_ptr<const void>(addr, [length](const void *p) {
+      munmap(const_cast<void *>(p), length);
+    });
+    mapped = reinterpret_cast<const float *>(static_cast<const char *>(addr) +
+                                             headerSize);
+    return true;
+  }
+
+public:
+  /** @brief Creates an empty index of 'dim' dimensional points */
+  explicit KNNIndex(int dim) : d(dim), ntotal(0), stride(0) {}
+
+  /** @brief Whether 'filename' holds an index of this type */
+  static bool is_native(const std::string &filename)
+  {
+    std::ifstream file(filename, std::ios::binary);
+    char header[magicSize];
+    if (!file.read(header, sizeof(header))) return false;
+    return std::memcmp(header, magic(), magicSize) == 0 ||
+           std::memcmp(header, rowsMagic(), magicSize) == 0;
+  }
+
+  /** @brief Reads an index from a file, returns null on failure.
+   *  @param[in] filename The index file.
+   *  @param[in] map Whether to map the coordinates instead of reading
+   *  them, for files that store them in the layout of the memory.
+   */
+  static KNNIndex *read(const std::string &filename, bool map = true)
+  {
+    std::ifstream file(filename, std::ios::binary);
+    char header[magicSize];
+    int64_t n = 0, fileStride = 0;
+    int32_t dim = 0, padding = 0;
+    if (!file.read(header, sizeof(header)) ||
+        (std::memcmp(header, magic(), magicSize) != 0 &&
+         std::memcmp(header, rowsMagic(), magicSize) != 0) ||
+        !file.read(reinterpret_cast<char *>(&n), sizeof(n)) ||
+        !file.read(reinterpret_cast<char *>(&dim), sizeof(dim)) ||
+        !file.read(reinterpret_cast<char *>(&padding), sizeof(padding)) ||
+        n < 0 || dim <= 0) {
+      WARNING(KNN, "%s is not a valid kNN index", filename.c_str())
+      return nullptr;
+    }
+
+    KNNIndex *index = new KNNIndex(dim);
+    if (std::memcmp(header, rowsMagic(), magicSize) == 0) {
+      std::vector<float> points(n * dim);
+      if (!file.read(reinterpret_cast<char *>(points.data()),
+                     points.size() * sizeof(float))) {
+        WARNING(KNN, "%s holds less than %ld points", filename.c_str(), n)
+        delete index;
+        return nullptr;
+      }
+      index->add(n, points.data());
+    } else {
+      if (!file.read(reinterpret_cast<char *>(&fileStride),
+                     sizeof(fileStride)) ||
+          fileStride < n || fileStride % lanes != 0) {
+        WARNING(KNN, "%s has an invalid stride", filename.c_str())
+        delete index;
+        return nullptr;
+      }
+      index->ntotal = n;
+      index->stride = fileStride;
+      const size_t numValues = fileStride * dim;
+      if (numValues > 0 && !(map && index->map(filename, numValues))) {
+        index->coords.resize(numValues);
+        if (!file.seekg(headerSize) ||
+            !file.read(reinterpret_cast<char *>(index->coords.data()),
+                       numValues * sizeof(float))) {
+          WARNING(KNN, "%s holds less than %ld points", filename.c_str(), n)
+          delete index;
+          return nullptr;
+        }
+      }
+    }
+    DBG(KNN,
+        "Read kNN index %s (%ld points of dimension %d, mapped %d)",
+        filename.c_str(),
+        n,
+        dim,
+        index->mapping != nullptr)
+    return index;
+  }
+
+  /** @brief Writes the index to a file */
+  void write(const std::string &filename) const
+  {
+    std::ofstream file(filename, std::ios::binary);
+    char header[headerSize] = {0};
+    const int64_t n = ntotal, fileStride = stride;
+    const int32_t dim = d;
+    std::memcpy(header, magic(), magicSize);
+    std::memcpy(header + magicSize, &n, sizeof(n));
+    std::memcpy(header + magicSize + sizeof(n), &dim, sizeof(dim));
+    std::memcpy(header + magicSize + sizeof(n) + 2 * sizeof(dim),
+                &fileStride,
+                sizeof(fileStride));
+    file.write(header, headerSize);
+    file.write(reinterpret_cast<const char *>(base()),
+               stride * d * sizeof(float));
+    CFATAL(KNN, !file, "Cannot write kNN index to %s", filename.c_str())
+  }
+
+  /** @brief Whether the coordinates are mapped from a file */
+  bool is_mapped() const { return mapping != nullptr; }
+
+  /** @brief The dimension of the points */
+  int dim() const { return d; }
+
+  /** @brief The number of points */
+  size_t count() const { return ntotal; }
+
+  /** @brief Appends points to the index.
+   *  @param[in] n The number of points.
+   *  @param[in] points The coordinates, point after point.
+   */
+  void add(size_t n, const float *points)
+  {
+    reserve(ntotal + n);
+    for (size_t i = 0; i < n; i++)
+      for (int k = 0; k < d; k++)
+        coords[k * stride + ntotal + i] = points[i * d + k];
+    ntotal += n;
+  }
+
+  /** @brief Finds the k nearest points of every query.
+   *  @param[in] n The number of queries.
+   *  @param[in] queries The coordinates of the queries, query after query.
+   *  @param[in] k The number of neighbors.
+   *  @param[out] outDistances The squared L2 distances of the neighbors of
+   *  every query in ascending order, n * k values.
+   *  @param[out] outLabels The positions of the neighbors, -1 when the index
+   *  holds less than k points, n * k values.
+   *  @param[in] parallel Whether to search on the shared thread pool. Tasks
+   *  of that pool search serially.
+   */
+  void search(size_t n,
+              const float *queries,
+              int k,
+              float *outDistances,
+              Label *outLabels,
+              bool parallel = true) const
+  {
+    auto run = [&](size_t begin, size_t end) {
+      searchRange(begin, end, queries, k, outDistances, outLabels);
+    };
+    // Small searches do not amortize waking up the threads
+    ThreadPool &threads = ThreadPool::shared();
+    if (!parallel || n <= queryBlock || n * ntotal < (1 << 18)) {
+      run(0, n);
+      return;
+    }
+    const size_t chunks = 4 * (threads.size() + 1);
+    const size_t grain =
+        std::max<size_t>(queryBlock, (n + chunks - 1) / chunks);
+    threads.parallel_for(n, grain, run);
+  }
+
+  /** @brief Decides whether the k nearest points of every query are closer
+   * than a bound, without computing them.
+   *  @param[in] n The number of queries.
+   *  @param[in] queries The coordinates of the queries, query after query.
+   *  @param[in] k The number of neighbors.
+   *  @param[in] bound The bound of the squared L2 distances.
+   *  @param[in] mean Whether the mean of the k smallest squared distances
+   *  is compared with the bound, otherwise the k-th smallest.
+   *  @param[out] accept Whether the distances are below the bound, as
+   *  search would decide up to rounding. Queries with less than k points
+   *  are rejected.
+   *  @param[in] parallel Whether to search on the shared thread pool.
+   *
+   *  @details A query stops scanning as soon as it is accepted: once k
+   *  points are below the bound, or once the mean of the k nearest points
+   *  found so far is. Rejections scan every point.
+   */
+  void decide(size_t n,
+              const float *queries,
+              int k,
+              float bound,
+              bool mean,
+              bool *accept,
+              bool parallel = true) const
+  {
+    auto run = [&](size_t begin, size_t end) {
+      decideRange(begin, end, queries, k, bound, mean, accept);
+    };
+    ThreadPool &threads = ThreadPool::shared();
+    if (!parallel || n <= queryBlock || n * ntotal < (1 << 18)) {
+      run(0, n);
+      return;
+    }
+    const size_t chunks = 4 * (threads.size() + 1);
+    const size_t grain =
+        std::max<size_t>(queryBlock, (n + chunks - 1) / chunks);
+    threads.parallel_for(n, grain, run);
+  }
+};
+
+}  // namespace ams
+
+#endif
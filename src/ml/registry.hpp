@@ -0,0 +1,126 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#ifndef __AMS_REGISTRY_HPP__
+#define __AMS_REGISTRY_HPP__
+
+#include <experimental/filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include "wf/debug.h"
+
+namespace ams
+{
+/**
+ * @brief A process wide registry sharing read-only objects loaded from
+ * files, such as surrogate models and UQ indices, across executors.
+ *
+ * @details Objects are identified by the path and the modification time of
+ * their file, the data type and the device they are loaded for, and the
+ * options they are configured with. The registry only holds weak
+ * references: an object is destroyed once the last executor using it
+ * releases it, and loaded again when requested later.
+ * Concurrent requests for the same object wait for a single load, requests
+ * for different objects load in parallel. Replacing a file changes its
+ * modification time, so a new version of a model is loaded next to the one
+ * executors currently use. Objects may map their file, new versions must
+ * then be written to another file and renamed over the old one.
+ *
+ * @tparam T The type of the objects.
+ */
+template <typename T>
+class Registry
+{
+  /** @brief path, modification time, data type, device, options */
+  using Key = std::
+      tuple<std::string, long long, std::string, std::string, std::string>;
+
+  /** @brief Owns a registered object. Users hold it through aliasing
+   * pointers, so it is destroyed with the last user */
+  struct Slot {
+    std::mutex mtx;
+    std::shared_ptr<T> object;
+  };
+
+  static std::mutex &mutex()
+  {
+    static std::mutex mtx;
+    return mtx;
+  }
+
+  static std::map<Key, std::weak_ptr<Slot>> &slots()
+  {
+    static std::map<Key, std::weak_ptr<Slot>> entries;
+    return entries;
+  }
+
+public:
+  /** @brief Returns the registered object or loads and registers it.
+   *  @param[in] path The path of the file the object is loaded from.
+   *  @param[in] dtype The data type the object is loaded with.
+   *  @param[in] device The device the object is loaded to.
+   *  @param[in] load Loads the object, returns null on failure. Failed
+   *  loads are not registered.
+   *  @param[in] options The configuration 'load' applies to the object.
+   *  @return The object, or null when it could not be loaded.
+   */
+  static std::shared_ptr<T> get(const std::string &path,
+                                const std::string &dtype,
+                                const std::string &device,
+                                const std::function<std::shared_ptr<T>()> &load,
+                                const std::string &options = "")
+  {
+    namespace fs = std::experimental::filesystem;
+    std::error_code ec;
+    auto mtime = fs::last_write_time(path, ec);
+    Key key(path,
+            ec ? 0 : static_cast<long long>(mtime.time_since_epoch().count()),
+            dtype,
+            device,
+            options);
+
+    std::shared_ptr<Slot> slot;
+    {
+      std::lock_guard<std::mutex> lock(mutex());
+      auto &entries = slots();
+      for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.expired())
+          it = entries.erase(it);
+        else
+          ++it;
+      }
+      auto &entry = entries[key];
+      slot = entry.lock();
+      if (!slot) {
+        slot = std::make_shared<Slot>();
+        entry = slot;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(slot->mtx);
+    if (slot->object) {
+      DBG(Registry,
+          "Sharing %s (%s, %s)",
+          path.c_str(),
+          dtype.c_str(),
+          device.c_str())
+    } else {
+      slot->object = load();
+      if (!slot->object) return nullptr;
+    }
+    return std::shared_ptr<T>(slot, slot->object.get());
+  }
+};
+
+}  // namespace ams
+
+#endif
@@ -8,12 +8,14 @@
 #ifndef __AMS_SURROGATE_HPP__
 #define __AMS_SURROGATE_HPP__
 
+#include <memory>
 #include <string>
 
 #ifdef __ENABLE_TORCH__
 #include <torch/script.h>  // One-stop header.
 #endif
 
+#include "ml/registry.hpp"
 #include "wf/data_handler.hpp"
 
 #include "wf/debug.h"
@@ -42,7 +44,11 @@ private:
   // -------------------------------------------------------------------------
   // variables to store the torch model
   // -------------------------------------------------------------------------
-  torch::jit::script::Module module;
+  // The module evaluated by the model and the module 'swap' replaces it
+  // with. Both are accessed atomically, evaluations hold a reference to the
+  // module they started with, so a swap never disrupts them.
+  std::shared_ptr<torch::jit::script::Module> module;
+  std::shared_ptr<torch::jit::script::Module> staged;
   c10::TensorOptions tensorOptions;
 
 
@@ -106,19 +112,55 @@ PERFFASPECT()
   // -------------------------------------------------------------------------
   // loading a surrogate model!
   // -------------------------------------------------------------------------
+  // Models are shared through the registry by all surrogates loading the
+  // same file with the same precision on the same device
+  std::shared_ptr<torch::jit::script::Module> _acquire(
+      const std::string& model_path)
+  {
+    using Module = torch::jit::script::Module;
+    const std::string dtype =
+        std::is_same<TypeInValue, double>::value ? "float64" : "float32";
+    return ams::Registry<Module>::get(
+        model_path, dtype, is_cpu ? "cpu" : "cuda", [&]() {
+          try {
+            auto m = std::make_shared<Module>(torch::jit::load(model_path));
+            m->to(tensorOptions.device());
+            m->to(c10::typeMetaToScalarType(tensorOptions.dtype()));
+            return m;
+          } catch (const c10::Error& e) {
+            WARNING(Surrogate, "Cannot load torch model:%s", model_path.c_str())
+          }
+          return std::shared_ptr<Module>();
+        });
+  }
+
 PERFFASPECT()
   void _load_torch(const std::string& model_path,
                    c10::Device&& device,
                    at::ScalarType dType)
   {
-    try {
-      module = torch::jit::load(model_path);
-      module.to(device);
-      module.to(dType);
-      tensorOptions = torch::TensorOptions().dtype(dType).device(device);
-    } catch (const c10::Error& e) {
-      FATAL("Error loding torch model:%s", model_path.c_str())
-    }
+    tensorOptions = torch::TensorOptions().dtype(dType).device(device);
+    auto m = _acquire(model_path);
+    CFATAL(Surrogate, !m, "Error loding torch model:%s", model_path.c_str())
+    std::atomic_store(&module, m);
+  }
+
+PERFFASPECT()
+  bool _stage(const std::string& model_path)
+  {
+    auto m = _acquire(model_path);
+    if (!m) return false;
+    std::atomic_store(&staged, m);
+    return true;
+  }
+
+  inline bool _swap()
+  {
+    auto m = std::atomic_exchange(
+        &staged, std::shared_ptr<torch::jit::script::Module>());
+    if (!m) return false;
+    std::atomic_store(&module, m);
+    return true;
   }
 
   template <typename T,
@@ -151,15 +193,51 @@ PERFFASPECT()
                         const TypeInValue** inputs,
                         TypeInValue** outputs)
   {
+    auto m = std::atomic_load(&module);
     auto input = arrayToTensor(num_elements, num_in, inputs);
-    at::Tensor output = module.forward({input}).toTensor();
+    at::Tensor output = m->forward({input}).toTensor();
 
     DBG(Surrogate, "Evaluate surrogate model (%ld, %ld) -> (%ld, %ld)",
         num_elements, num_in, num_elements, num_out);
     tensorToArray(output, num_elements, num_out, outputs);
   }
 
+  // -------------------------------------------------------------------------
+  // warm up a torch model
+  // -------------------------------------------------------------------------
+  inline long _inputDim() const
+  {
+    // The first matrix of the model maps the inputs to the first layer
+    auto m = std::atomic_load(&module);
+    for (const auto& param : m->parameters()) {
+      if (param.dim() == 2) return param.size(1);
+    }
+    return -1;
+  }
+
+PERFFASPECT()
+  inline void _warmup(const std::vector<long>& batchSizes, long num_in)
+  {
+    auto m = std::atomic_load(&module);
+    for (auto batch : batchSizes) {
+      if (batch <= 0) continue;
+      auto input = torch::rand({batch, num_in}, tensorOptions);
+      at::Tensor output = m->forward({input}).toTensor();
+      // Reading a value waits for asynchronous (device) execution to complete
+      output.sum().template item<TypeInValue>();
+      DBG(Surrogate, "Warmed up surrogate model with (%ld, %ld)", batch, num_in);
+    }
+  }
+
 #else
+  inline long _inputDim() const { return -1; }
+
+  inline bool _stage(const std::string&) { return false; }
+
+  inline bool _swap() { return false; }
+
+  inline void _warmup(const std::vector<long>&, long) {}
+
   template <typename T>
 PERFFASPECT()
   inline void _load(const std::string& model_path,
@@ -202,6 +280,38 @@ PERFFASPECT()
     _evaluate(num_elements, num_in, num_out, inputs, outputs);
   }
 
+  /** @brief The number of inputs the model expects, inferred from its
+   * first two dimensional parameter. Returns -1 when it cannot be inferred.
+   */
+  inline long inputDim() const { return _inputDim(); }
+
+  /** @brief Loads a new model next to the one in use. Evaluations keep
+   * using the current model until 'swap' is called. Can be called by a
+   * background thread while the model is evaluated.
+   * @param[in] path The path of the TorchScript model.
+   * @return Whether the model was loaded. On failure the current model is
+   * kept.
+   */
+PERFFASPECT()
+  inline bool stage(const std::string& path) { return _stage(path); }
+
+  /** @brief Replaces the current model with the staged one. Evaluations in
+   * flight complete with the model they started with.
+   * @return Whether a staged model replaced the current one.
+   */
+  inline bool swap() { return _swap(); }
+
+  /** @brief Runs the model on synthetic inputs so that TorchScript
+   * optimizations and allocator growth happen before the first evaluation.
+   * @param[in] batchSizes The numbers of elements to evaluate the model on.
+   * @param[in] num_in The number of inputs of the model.
+   */
+PERFFASPECT()
+  inline void warmup(const std::vector<long>& batchSizes, long num_in)
+  {
+    _warmup(batchSizes, num_in);
+  }
+
 PERFFASPECT()
   inline void evaluate(long num_elements,
                        std::vector<const TypeInValue*> inputs,
@@ -8,11 +8,14 @@
 #ifndef __AMS_BASE_DB__
 #define __AMS_BASE_DB__
 
+#include <condition_variable>
 #include <experimental/filesystem>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "AMS.h"
@@ -110,6 +113,18 @@ public:
   virtual void store(size_t num_elements,
                      std::vector<TypeValue*>& inputs,
                      std::vector<TypeValue*>& outputs) = 0;
+
+  /**
+   * @brief Pops the oldest received message whose body starts with
+   * 'prefix'. Databases without an inbound channel never receive messages.
+   * @param[in] prefix The prefix identifying the messages of interest
+   * @param[out] body The body of the message
+   * @return Whether a message was popped
+   */
+  virtual bool pop_message(const std::string& prefix, std::string& body)
+  {
+    return false;
+  }
 };
 
 /**
@@ -687,6 +702,7 @@ struct rmq_consumer {
   std::shared_ptr<AMQP::TcpChannel> channel;
   std::string queue;
   std::shared_ptr<std::vector<inbound_msg>> messages;  // Messages received
+  std::shared_ptr<std::mutex> messages_mtx;  // Guards messages
 };
 
 /**
@@ -715,11 +731,6 @@ void* start_worker_consumer(void* arg)
     // acknowledge the message
     w->channel->ack(deliveryTag);
     std::string s(message.body(), message.bodySize());
-    w->messages->push_back(std::make_tuple(std::move(s),
-                                           message.exchange(),
-                                           message.routingkey(),
-                                           deliveryTag,
-                                           redelivered));
     DBG(RabbitMQDB,
         "message received [tag=%d] : '%s' of size %d B from '%s'/'%s'",
         deliveryTag,
@@ -727,6 +738,12 @@ void* start_worker_consumer(void* arg)
         message.bodySize(),
         message.exchange().c_str(),
         message.routingkey().c_str())
+    std::lock_guard<std::mutex> lock(*w->messages_mtx);
+    w->messages->push_back(std::make_tuple(std::move(s),
+                                           message.exchange(),
+                                           message.routingkey(),
+                                           deliveryTag,
+                                           redelivered));
   };
 
   /* callback that is called when the consumer is cancelled by RabbitMQ (this
@@ -1166,6 +1183,8 @@ private:
   int _nb_msg_send;
   /** @brief Queue that contains all the messages received on receiver queue */
   std::shared_ptr<std::vector<inbound_msg>> _messages;
+  /** @brief Guards _messages, which the receiver thread fills */
+  std::shared_ptr<std::mutex> _messages_mtx;
 
   /**
    * @brief Read a JSON and create a hashmap
@@ -1368,6 +1387,9 @@ private:
     _receiver->channel = _channel_receive;
     // Structure that will contain all messages received
     _receiver->messages = std::make_shared<std::vector<inbound_msg>>();
+    _receiver->messages_mtx = std::make_shared<std::mutex>();
+    _messages = _receiver->messages;
+    _messages_mtx = _receiver->messages_mtx;
     if (pthread_create(
             &_receiver->id, NULL, start_worker_consumer, _receiver.get())) {
       FATAL(RabbitMQDB, "error pthread_create for receiver worker");
@@ -1494,6 +1516,7 @@ public:
    */
   inbound_msg pop_messages()
   {
+    std::lock_guard<std::mutex> lock(*_messages_mtx);
     if (!(_messages->empty())) {
       inbound_msg msg = _messages->back();
       _messages->pop_back();
@@ -1510,6 +1533,7 @@ public:
    */
   inbound_msg get_messages(uint64_t delivery_tag)
   {
+    std::lock_guard<std::mutex> lock(*_messages_mtx);
     if (!(_messages->empty())) {
       auto it = std::find_if(_messages->begin(),
                              _messages->end(),
@@ -1521,6 +1545,27 @@ public:
     return std::make_tuple("", "", "", -1, false);
   }
 
+  /**
+   * @brief Pops the oldest received message whose body starts with 'prefix'
+   * @param[in] prefix The prefix identifying the messages of interest
+   * @param[out] body The body of the message
+   * @return Whether a message was popped
+   */
+  bool pop_message(const std::string& prefix, std::string& body) override
+  {
+    std::lock_guard<std::mutex> lock(*_messages_mtx);
+    auto it = std::find_if(_messages->begin(),
+                           _messages->end(),
+                           [&prefix](const inbound_msg& e) {
+                             return std::get<0>(e).compare(
+                                        0, prefix.size(), prefix) == 0;
+                           });
+    if (it == _messages->end()) return false;
+    body = std::get<0>(*it);
+    _messages->erase(it);
+    return true;
+  }
+
   /**
    * @brief Takes an input and an output vector each holding 1-D vectors data, and push
    * it onto the libevent buffer. We flatten the inputs/outputs and send one 
@@ -1614,6 +1659,209 @@ public:
 #endif  // __ENABLE_RMQ__
 
 
+/**
+ * @brief A database decorator that moves the stores of another database off
+ * the critical path of the application.
+ *
+ * @details store() copies the data into one of a fixed number of staging
+ * buffers organized as a ring and returns immediately. A dedicated writer
+ * thread drains the ring in order into the wrapped database. When all
+ * staging buffers are in flight store() blocks until the writer releases
+ * one (backpressure). The staging buffers grow to the largest store they
+ * served and are reused afterwards. Destroying the object flushes all
+ * pending stores before destroying the wrapped database.
+ */
+template <typename TypeValue>
+class AsyncDB final : public BaseDB<TypeValue>
+{
+private:
+  /** @brief A staging buffer holding the inputs followed by the outputs of
+   * a single store */
+  struct StagingBuffer {
+    size_t num_elements = 0;
+    size_t num_in = 0;
+    size_t num_out = 0;
+    bool ready = false;
+    std::vector<TypeValue> data;
+  };
+
+  /** @brief The database that performs the actual stores */
+  BaseDB<TypeValue>* db;
+
+  /** @brief The ring of staging buffers */
+  std::vector<StagingBuffer> ring;
+
+  /** @brief Index of the next buffer to be filled by store() */
+  size_t head;
+
+  /** @brief Index of the next buffer to be drained by the writer */
+  size_t tail;
+
+  /** @brief Number of buffers that are either being filled or waiting to be
+   * drained */
+  size_t inFlight;
+
+  /** @brief Set upon destruction to terminate the writer thread */
+  bool stop;
+
+  std::mutex mtx;
+  /** @brief Signaled when the writer releases a buffer */
+  std::condition_variable notFull;
+  /** @brief Signaled when a buffer is ready to be drained or on stop */
+  std::condition_variable notEmpty;
+  /** @brief Signaled when all buffers have been drained */
+  std::condition_variable drained;
+
+  /** @brief The writer thread draining the ring into 'db' */
+  std::thread writer;
+
+  /** @brief The main loop of the writer thread */
+  void drain()
+  {
+    std::vector<TypeValue*> inputs, outputs;
+    while (true) {
+      std::unique_lock<std::mutex> lock(mtx);
+      notEmpty.wait(lock, [&]() {
+        return (inFlight > 0 && ring[tail].ready) || (stop && inFlight == 0);
+      });
+      if (inFlight == 0) return;
+
+      StagingBuffer& buffer = ring[tail];
+      lock.unlock();
+
+      inputs.clear();
+      outputs.clear();
+      TypeValue* ptr = buffer.data.data();
+      for (size_t i = 0; i < buffer.num_in; i++, ptr += buffer.num_elements)
+        inputs.push_back(ptr);
+      for (size_t i = 0; i < buffer.num_out; i++, ptr += buffer.num_elements)
+        outputs.push_back(ptr);
+      db->store(buffer.num_elements, inputs, outputs);
+
+      lock.lock();
+      buffer.ready = false;
+      tail = (tail + 1) % ring.size();
+      inFlight--;
+      notFull.notify_one();
+      if (inFlight == 0) drained.notify_all();
+    }
+  }
+
+public:
+  AsyncDB(const AsyncDB&) = delete;
+  AsyncDB& operator=(const AsyncDB&) = delete;
+
+  /**
+   * @brief constructs the class and starts the writer thread
+   * @param[in] db The database to forward the stores to. AsyncDB takes
+   * ownership of it.
+   * @param[in] nBuffers Number of staging buffers, i.e. the maximum number of
+   * stores that can be pending before store() blocks.
+   * @param[in] rId a unique Id for each process taking part in a distributed
+   * execution (rank-id)
+   */
+  AsyncDB(BaseDB<TypeValue>* db, size_t nBuffers, uint64_t rId)
+      : BaseDB<TypeValue>(rId),
+        db(db),
+        ring(std::max(nBuffers, static_cast<size_t>(1))),
+        head(0),
+        tail(0),
+        inFlight(0),
+        stop(false)
+  {
+    DBG(DB,
+        "Storing asynchronously to %s DB with %ld staging buffers",
+        db->type().c_str(),
+        ring.size())
+    writer = std::thread(&AsyncDB::drain, this);
+  }
+
+  /**
+   * @brief flushes all pending stores, stops the writer thread and destroys
+   * the wrapped database.
+   */
+  ~AsyncDB()
+  {
+    flush();
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stop = true;
+    }
+    notEmpty.notify_all();
+    writer.join();
+    delete db;
+  }
+
+  /**
+   * @brief Define the type of the DB (File, Redis etc)
+   */
+  std::string type() override { return "async-" + db->type(); }
+
+  /**
+   * @brief Forwards to the wrapped database, which owns the inbound channel
+   */
+  bool pop_message(const std::string& prefix, std::string& body) override
+  {
+    return db->pop_message(prefix, body);
+  }
+
+  /**
+   * @brief Blocks until all pending stores have reached the wrapped database
+   */
+  void flush()
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    drained.wait(lock, [&]() { return inFlight == 0; });
+  }
+
+  /**
+   * @brief Takes an input and an output vector each holding 1-D vectors data,
+   * copies them into a staging buffer and schedules them to be stored by the
+   * writer thread. The caller is free to reuse its memory once the function
+   * returns.
+   * @param[in] num_elements Number of elements of each 1-D vector
+   * @param[in] inputs Vector of 1-D vectors, each 1-D vectors contains
+   * 'num_elements'  values to be stored
+   * @param[in] outputs Vector of 1-D vectors, each 1-D vectors contains
+   * 'num_elements'  values to be stored
+   */
+  PERFFASPECT()
+  void store(size_t num_elements,
+             std::vector<TypeValue*>& inputs,
+             std::vector<TypeValue*>& outputs) override
+  {
+    if (num_elements == 0) return;
+
+    std::unique_lock<std::mutex> lock(mtx);
+    notFull.wait(lock, [&]() { return inFlight < ring.size(); });
+    StagingBuffer& buffer = ring[head];
+    head = (head + 1) % ring.size();
+    inFlight++;
+    lock.unlock();
+
+    // The writer never touches a buffer that is not ready, so we can fill it
+    // without holding the lock.
+    buffer.num_elements = num_elements;
+    buffer.num_in = inputs.size();
+    buffer.num_out = outputs.size();
+    buffer.data.resize((buffer.num_in + buffer.num_out) * num_elements);
+    TypeValue* ptr = buffer.data.data();
+    for (auto* in : inputs) {
+      std::copy(in, in + num_elements, ptr);
+      ptr += num_elements;
+    }
+    for (auto* out : outputs) {
+      std::copy(out, out + num_elements, ptr);
+      ptr += num_elements;
+    }
+
+    lock.lock();
+    buffer.ready = true;
+    lock.unlock();
+    notEmpty.notify_one();
+  }
+};
+
 /**
  * @brief Create an object of the respective database.
  * This should never be used for large scale simulations as txt/csv format will
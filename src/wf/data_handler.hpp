@@ -14,6 +14,7 @@
 
 #include "wf/device.hpp"
 #include "wf/resource_manager.hpp"
+#include "wf/thread_pool.hpp"
 #include "wf/utils.hpp"
 
 namespace ams
@@ -143,20 +144,59 @@ PERFFASPECT()
     const size_t nvalues = n * nfeatures;
 
     TypeValue* data = ams::ResourceManager::allocate<TypeValue>(nvalues);
+    linearize_features(n, features, data);
+    return data;
+  }
 
-    const bool features_on_device =
-        ams::ResourceManager::is_on_device(features[0]);
+  /* @brief linearize all elements of a vector of C-vectors into an
+   * existing C-vector, casting them to 'TypeValue' on the way.
+   *
+   * Host features are transposed in blocks of rows whose values stay in
+   * cache, and large inputs are split across the shared thread pool.
+   *
+   * @tparam TypeInValue Type of the source value.
+   * @param[in] n The number of elements of the vectors.
+   * @param[in] features A vector containing C-vector of feature values.
+   * @param[out] data The linearized values, n * features.size() elements
+   * resident in the same device as the input feature pointers.
+   */
+  template <typename TypeInValue>
+PERFFASPECT()
+  static inline void linearize_features(
+      const size_t n,
+      const std::vector<const TypeInValue*>& features,
+      TypeValue* data)
+  {
+    const size_t nfeatures = features.size();
+    if (ams::ResourceManager::is_on_device(features[0])) {
+      ams::Device::linearize(data, features.data(), nfeatures, n);
+      return;
+    }
 
-    if (!features_on_device) {
-      for (size_t d = 0; d < nfeatures; d++) {
-        for (size_t i = 0; i < n; i++) {
-          data[i * nfeatures + d] = static_cast<TypeValue>(features[d][i]);
+    const TypeInValue* const* columns = features.data();
+    auto transpose = [&](size_t begin, size_t end) {
+      const size_t rowBlock = 1024;
+      for (size_t b = begin; b < end; b += rowBlock) {
+        const size_t e = std::min(end, b + rowBlock);
+        for (size_t d = 0; d < nfeatures; d++) {
+          const TypeInValue* column = columns[d];
+          TypeValue* out = data + d;
+          for (size_t i = b; i < e; i++)
+            out[i * nfeatures] = static_cast<TypeValue>(column[i]);
         }
       }
-    } else {
-      ams::Device::linearize(data, features.data(), nfeatures, n);
+    };
+
+    // Small inputs do not amortize waking up the threads
+    ams::ThreadPool& threads = ams::ThreadPool::shared();
+    if (n * nfeatures < (1 << 18)) {
+      transpose(0, n);
+      return;
     }
-    return data;
+    const size_t chunks = 4 * (threads.size() + 1);
+    threads.parallel_for(n,
+                         std::max<size_t>(16384, (n + chunks - 1) / chunks),
+                         transpose);
   }
 
   /* @brief The function stores all elements of the sparse
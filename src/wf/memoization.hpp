@@ -0,0 +1,260 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#ifndef __AMS_MEMOIZATION_HPP__
+#define __AMS_MEMOIZATION_HPP__
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "wf/debug.h"
+
+namespace ams
+{
+/**
+ * @brief A concurrent cache mapping quantized input vectors to outputs.
+ *
+ * @details Every input value is divided by the quantization tolerance and
+ * rounded, so inputs closer than the tolerance usually map to the same key.
+ * With a tolerance of 0 inputs have to match exactly. The table is set
+ * associative: a key hashes to a set of 'ways' entries that is searched
+ * linearly, and a full set evicts an entry with the clock algorithm. Every
+ * set has its own spin lock, so threads only contend when they touch the
+ * same set. The cache holds host memory only.
+ *
+ * @tparam FPTypeValue The type of the inputs and outputs.
+ */
+template <typename FPTypeValue>
+class MemoizationCache
+{
+public:
+  /** @brief Number of entries of every set */
+  static constexpr size_t ways = 8;
+
+private:
+  struct Set {
+    std::atomic<bool> locked;
+    /** @brief The next way the clock algorithm considers for eviction */
+    uint8_t hand;
+    /** @brief The ways holding an entry */
+    uint8_t valid;
+    /** @brief The ways accessed since the clock hand last passed */
+    uint8_t referenced;
+    uint64_t hashes[ways];
+  };
+
+  const int inputDim;
+  const int outputDim;
+  const double tolerance;
+  size_t numSets;
+
+  std::unique_ptr<Set[]> sets;
+  /** @brief The quantized inputs of every entry */
+  std::vector<int64_t> keys;
+  /** @brief The outputs of every entry */
+  std::vector<FPTypeValue> values;
+
+  std::atomic<uint64_t> numHits;
+  std::atomic<uint64_t> numMisses;
+
+  class SetLock
+  {
+    Set &set;
+
+  public:
+    SetLock(Set &set) : set(set)
+    {
+      while (set.locked.exchange(true, std::memory_order_acquire)) {
+      }
+    }
+    ~SetLock() { set.locked.store(false, std::memory_order_release); }
+  };
+
+  /** @brief Quantizes the inputs of element 'index' into 'key' and returns
+   * the hash of the key */
+  uint64_t quantize(const std::vector<const FPTypeValue *> &inputs,
+                    size_t index,
+                    int64_t *key) const
+  {
+    uint64_t hash = 1469598103934665603ULL;
+    for (int i = 0; i < inputDim; i++) {
+      FPTypeValue v = inputs[i][index];
+      if (tolerance > 0) {
+        key[i] = static_cast<int64_t>(std::llround(v / tolerance));
+      } else {
+        // Exact matching, -0.0 and 0.0 are treated as different keys
+        double d = v;
+        std::memcpy(&key[i], &d, sizeof(int64_t));
+      }
+      // splitmix64 finalizer folded into an FNV style combination
+      uint64_t k = static_cast<uint64_t>(key[i]) + 0x9e3779b97f4a7c15ULL;
+      k = (k ^ (k >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      k = (k ^ (k >> 27)) * 0x94d049bb133111ebULL;
+      k ^= k >> 31;
+      hash = (hash ^ k) * 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  /** @brief Returns the way of 'set' holding 'key' or -1 */
+  int find(size_t set, uint64_t hash, const int64_t *key) const
+  {
+    const Set &s = sets[set];
+    for (size_t w = 0; w < ways; w++) {
+      if (!(s.valid & (1u << w)) || s.hashes[w] != hash) continue;
+      const int64_t *stored = &keys[(set * ways + w) * inputDim];
+      if (std::memcmp(stored, key, inputDim * sizeof(int64_t)) == 0) return w;
+    }
+    return -1;
+  }
+
+public:
+  /** @brief Creates the cache.
+   *  @param[in] inputDim The number of inputs of an element.
+   *  @param[in] outputDim The number of outputs of an element.
+   *  @param[in] capacity The minimum number of elements the cache holds.
+   *  @param[in] tolerance The quantization step of the inputs.
+   */
+  MemoizationCache(int inputDim,
+                   int outputDim,
+                   size_t capacity,
+                   double tolerance)
+      : inputDim(inputDim),
+        outputDim(outputDim),
+        tolerance(tolerance),
+        numSets(1),
+        numHits(0),
+        numMisses(0)
+  {
+    while (numSets * ways < capacity)
+      numSets <<= 1;
+    sets.reset(new Set[numSets]);
+    for (size_t i = 0; i < numSets; i++) {
+      sets[i].locked = false;
+      sets[i].hand = 0;
+      sets[i].valid = 0;
+      sets[i].referenced = 0;
+    }
+    keys.resize(numSets * ways * inputDim);
+    values.resize(numSets * ways * outputDim);
+    DBG(Memoization,
+        "Created memoization cache with %ld entries (tolerance %f)",
+        numSets * ways,
+        tolerance)
+  }
+
+  MemoizationCache(const MemoizationCache &) = delete;
+  MemoizationCache &operator=(const MemoizationCache &) = delete;
+
+  /** @brief Looks up elements in the cache.
+   *  @param[in] n The number of elements.
+   *  @param[in] inputs The inputs of the elements.
+   *  @param[out] outputs The outputs of the elements found in the cache.
+   *  @param[out] hits Whether every element was found.
+   *  @return The number of elements found.
+   */
+  size_t lookup(size_t n,
+                const std::vector<const FPTypeValue *> &inputs,
+                std::vector<FPTypeValue *> &outputs,
+                bool *hits)
+  {
+    std::vector<int64_t> key(inputDim);
+    size_t found = 0;
+    for (size_t e = 0; e < n; e++) {
+      uint64_t hash = quantize(inputs, e, key.data());
+      size_t set = hash & (numSets - 1);
+      SetLock lock(sets[set]);
+      int w = find(set, hash, key.data());
+      hits[e] = (w >= 0);
+      if (w < 0) continue;
+      sets[set].referenced |= (1u << w);
+      const FPTypeValue *value = &values[(set * ways + w) * outputDim];
+      for (int o = 0; o < outputDim; o++)
+        outputs[o][e] = value[o];
+      found++;
+    }
+    numHits.fetch_add(found, std::memory_order_relaxed);
+    numMisses.fetch_add(n - found, std::memory_order_relaxed);
+    return found;
+  }
+
+  /** @brief Inserts elements to the cache, replacing the outputs of
+   * elements already present.
+   *  @param[in] n The number of elements.
+   *  @param[in] inputs The inputs of the elements.
+   *  @param[in] outputs The outputs of the elements.
+   */
+  void insert(size_t n,
+              const std::vector<const FPTypeValue *> &inputs,
+              const std::vector<FPTypeValue *> &outputs)
+  {
+    std::vector<int64_t> key(inputDim);
+    for (size_t e = 0; e < n; e++) {
+      uint64_t hash = quantize(inputs, e, key.data());
+      size_t set = hash & (numSets - 1);
+      Set &s = sets[set];
+      SetLock lock(s);
+      int w = find(set, hash, key.data());
+      if (w < 0) {
+        if (s.valid != 0xff) {
+          // Take the first free way
+          w = 0;
+          while (s.valid & (1u << w))
+            w++;
+        } else {
+          // Clock: skip and clear referenced ways until we find one that
+          // was not accessed since the hand last passed.
+          while (s.referenced & (1u << s.hand)) {
+            s.referenced &= ~(1u << s.hand);
+            s.hand = (s.hand + 1) % ways;
+          }
+          w = s.hand;
+          s.hand = (s.hand + 1) % ways;
+        }
+        s.valid |= (1u << w);
+        s.hashes[w] = hash;
+        std::memcpy(&keys[(set * ways + w) * inputDim],
+                    key.data(),
+                    inputDim * sizeof(int64_t));
+      }
+      s.referenced |= (1u << w);
+      FPTypeValue *value = &values[(set * ways + w) * outputDim];
+      for (int o = 0; o < outputDim; o++)
+        value[o] = outputs[o][e];
+    }
+  }
+
+  /** @brief Removes all entries. Safe to call concurrently with lookups
+   * and inserts, which then observe the cache either before or after
+   * clearing every set */
+  void clear()
+  {
+    for (size_t set = 0; set < numSets; set++) {
+      SetLock lock(sets[set]);
+      sets[set].valid = 0;
+      sets[set].referenced = 0;
+      sets[set].hand = 0;
+    }
+  }
+
+  /** @brief The number of entries the cache can hold */
+  size_t capacity() const { return numSets * ways; }
+
+  /** @brief The number of elements found by lookups */
+  uint64_t hits() const { return numHits.load(std::memory_order_relaxed); }
+
+  /** @brief The number of elements not found by lookups */
+  uint64_t misses() const { return numMisses.load(std::memory_order_relaxed); }
+};
+
+}  // namespace ams
+
+#endif
@@ -64,13 +64,13 @@ class AMSLoadBalancer
   int worldSize;
 
   /** @brief The initial number of elements this process (before load balancing) */
-  int localLoad;
+  long localLoad;
 
   /** @brief The total number of elements across all processes in the communicator */
-  int globalLoad;
+  long globalLoad;
 
   /** @brief The balanced number of elements this process */
-  int balancedLoad;
+  long balancedLoad;
 
   /** @brief The current communicator to load balance. */
   MPI_Comm Comm;
@@ -125,28 +125,43 @@ private:
     }
 
     // Gather the the number of items from each rank
+    std::vector<long> loads((rId == root) ? worldSize : 0);
     int rc = MPI_Gather(reinterpret_cast<const void *>(&localLoad),
                         1,
-                        MPI_INT,
-                        reinterpret_cast<void *>(dataElements),
+                        MPI_LONG,
+                        reinterpret_cast<void *>(loads.data()),
                         1,
-                        MPI_INT,
+                        MPI_LONG,
                         root,
                         Comm);
     CFATAL(LoadBalance, rc != MPI_SUCCESS, "Cannot gather per rank sizes")
 
-    // Populate displacement array
-    if (rId == 0) {
+    if (rId == root) {
       globalLoad = 0;
+      for (int i = 0; i < worldSize; ++i)
+        globalLoad += loads[i];
+    }
+
+    balancedLoad = computeBalanceLoad();
+
+    // MPI counts and displacements are int, the elements the root gathers
+    // need to fit in them
+    CFATAL(LoadBalance,
+           globalLoad > std::numeric_limits<int>::max(),
+           "Cannot balance %ld elements, set a tile size to balance at most "
+           "%d elements across all ranks at once",
+           globalLoad,
+           std::numeric_limits<int>::max())
+
+    // Populate displacement array
+    if (rId == root) {
       displs[0] = static_cast<int>(0);
-      for (size_t i = 0ul; i < worldSize; ++i) {
+      for (int i = 0; i < worldSize; ++i) {
+        dataElements[i] = static_cast<int>(loads[i]);
         displs[i + 1] = dataElements[i] + displs[i];
       }
-      globalLoad = displs[worldSize];
     }
 
-    balancedLoad = computeBalanceLoad();
-
     if (rId == root) {
       balancedElements =
           ResourceManager::allocate<int>(worldSize, AMSResourceType::HOST);
@@ -176,13 +191,13 @@ private:
   /** @brief Computes the number of elements every rank will receive after balancing.
    *  @returns the number of elements computed by this rank.
    **/
-  int computeBalanceLoad()
+  long computeBalanceLoad()
   {
-    int rc = MPI_Bcast(&globalLoad, 1, MPI_INT, root, Comm);
+    int rc = MPI_Bcast(&globalLoad, 1, MPI_LONG, root, Comm);
     CFATAL(LoadBalance, rc != MPI_SUCCESS, "Cannot broadcast global load")
 
-    int load = (globalLoad / worldSize) +
-               static_cast<int>(rId < (globalLoad % worldSize));
+    long load = (globalLoad / worldSize) +
+                static_cast<long>(rId < (globalLoad % worldSize));
     return load;
   }
 
@@ -308,7 +323,7 @@ public:
    */
   AMSLoadBalancer(int rId,
                   int worldSize,
-                  int localLoad,
+                  long localLoad,
                   MPI_Comm comm,
                   int numIn,
                   int numOut,
@@ -330,7 +345,7 @@ public:
   /** @brief deallocates all objects of this load balancing transcation */
   ~AMSLoadBalancer()
   {
-    CINFO(LoadBalance, root==rId, "Total data %d Data per rank %d", globalLoad, balancedLoad);
+    CINFO(LoadBalance, root==rId, "Total data %ld Data per rank %ld", globalLoad, balancedLoad);
     if (displs) ams::ResourceManager::deallocate(displs, AMSResourceType::HOST);
     if (dataElements)
       ams::ResourceManager::deallocate(dataElements, AMSResourceType::HOST);
@@ -370,8 +385,8 @@ public:
                 dataElements,    // Expecting to gather these
                 displs,
                 dType,
-                balancedLoad,
-                localLoad,
+                static_cast<int>(balancedLoad),
+                static_cast<int>(localLoad),
                 resource);
     return;
   }
@@ -398,8 +413,8 @@ public:
                 balancedElements,
                 balancedDispls,  // Distribute the balanced load
                 dType,
-                localLoad,
-                balancedLoad,
+                static_cast<int>(localLoad),
+                static_cast<int>(balancedLoad),
                 resource);
   }
 
@@ -419,7 +434,7 @@ public:
    * @brief Get the number of elements in the balanced vector.
    * \returns The number of elements in each balanced vector.
    **/
-  int getBalancedSize() { return balancedLoad; }
+  long getBalancedSize() { return balancedLoad; }
 };
 }  // namespace ams
 
@@ -9,6 +9,7 @@
 #define __AMS_ALLOCATOR__
 
 #include <cstddef>
+#include <mutex>
 #include <umpire/Allocator.hpp>
 #include <umpire/ResourceManager.hpp>
 #include <umpire/Umpire.hpp>
@@ -39,6 +40,14 @@ private:
   /** @brief The names of the user defined allocators */
   static std::string allocator_names[AMSResourceType::RSEND];
 
+  /** @brief Serializes allocations, the pooled umpire allocators are not
+   * thread safe */
+  static std::mutex& allocatorMutex()
+  {
+    static std::mutex mtx;
+    return mtx;
+  }
+
 public:
   ResourceManager() = delete;
   ResourceManager(const ResourceManager&) = delete;
@@ -142,6 +151,7 @@ PERFFASPECT()
   {
     static auto& rm = umpire::ResourceManager::getInstance();
     DBG(ResourceManager, "Requesting to allocate %ld values using allocator :%s %d", nvalues, getAllocatorName(dev));
+    std::lock_guard<std::mutex> lock(allocatorMutex());
     auto alloc = rm.getAllocator(allocator_ids[dev]);
     TypeInValue *ret = static_cast<TypeInValue*>(alloc.allocate(nvalues * sizeof(TypeInValue)));
     CFATAL(ResourceManager, ret == nullptr,
@@ -160,6 +170,7 @@ PERFFASPECT()
   static void deallocate(TypeInValue* data, AMSResourceType dev)
   {
     static auto& rm = umpire::ResourceManager::getInstance();
+    std::lock_guard<std::mutex> lock(allocatorMutex());
     if (hasAllocator(data)) {
       rm.getAllocator(allocator_ids[dev]).deallocate(data);
     }
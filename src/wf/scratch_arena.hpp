@@ -0,0 +1,284 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#ifndef __AMS_SCRATCH_ARENA_HPP__
+#define __AMS_SCRATCH_ARENA_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AMS.h"
+#include "wf/debug.h"
+#include "wf/resource_manager.hpp"
+
+namespace ams
+{
+/**
+ * @brief A grow-only bump allocator holding the temporaries of a single
+ * AMSWorkflow::evaluate call.
+ *
+ * @details The arena owns one allocation obtained through the
+ * ams::ResourceManager. Every evaluate call first reserves the total number
+ * of bytes it needs and then carves its buffers out of the arena. Memory is
+ * only returned to the resource manager when the arena has to grow or when
+ * it is destroyed, so in steady state evaluate performs no allocations at
+ * all. All buffers are aligned to 'alignment' bytes so that they can be
+ * consumed by vectorized kernels.
+ */
+class ScratchArena
+{
+public:
+  /** @brief Alignment (in bytes) of every buffer returned by the arena */
+  static constexpr size_t alignment = 64;
+
+private:
+  /** @brief The resource the arena allocates from */
+  AMSResourceType resource;
+
+  /** @brief The allocation as returned by the resource manager */
+  uint8_t *base;
+
+  /** @brief The first aligned byte inside 'base' */
+  uint8_t *aligned;
+
+  /** @brief Number of usable bytes starting at 'aligned' */
+  size_t cap;
+
+  /** @brief Number of bytes handed out since the last reset */
+  size_t offset;
+
+  /** @brief Maximum number of bytes ever handed out */
+  size_t highWater;
+
+  /** @brief Number of times the arena requested memory from the resource
+   * manager */
+  size_t numGrows;
+
+  /** @brief Return the backing allocation to the resource manager */
+  void release()
+  {
+    if (base != nullptr) ams::ResourceManager::deallocate(base, resource);
+    base = nullptr;
+    aligned = nullptr;
+    cap = 0;
+  }
+
+public:
+  ScratchArena(AMSResourceType resource)
+      : resource(resource),
+        base(nullptr),
+        aligned(nullptr),
+        cap(0),
+        offset(0),
+        highWater(0),
+        numGrows(0)
+  {
+  }
+
+  ScratchArena(const ScratchArena &) = delete;
+  ScratchArena &operator=(const ScratchArena &) = delete;
+
+  ~ScratchArena()
+  {
+    DBG(ScratchArena,
+        "Releasing scratch arena (capacity %ld B, high-water mark %ld B, "
+        "%ld allocations)",
+        cap,
+        highWater,
+        numGrows)
+    release();
+  }
+
+  /** @brief Number of bytes a buffer of n values occupies inside the arena.
+   *  @tparam T The type of the values.
+   *  @param[in] n Number of values.
+   *  @return The size of the buffer rounded up to the arena alignment.
+   */
+  template <typename T>
+  static constexpr size_t footprint(size_t n)
+  {
+    return ((n * sizeof(T) + alignment - 1) / alignment) * alignment;
+  }
+
+  /** @brief Invalidates all buffers handed out so far and makes sure
+   * at least 'bytes' can be handed out before the next reset.
+   *  @param[in] bytes The number of bytes (as computed by footprint) the
+   *  caller will request until the next reset.
+   */
+  void reserve(size_t bytes)
+  {
+    offset = 0;
+    if (bytes <= cap) return;
+
+    release();
+    base = ams::ResourceManager::allocate<uint8_t>(bytes + alignment, resource);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(base);
+    aligned = reinterpret_cast<uint8_t *>((addr + alignment - 1) &
+                                          ~(uintptr_t)(alignment - 1));
+    cap = bytes;
+    numGrows++;
+    DBG(ScratchArena, "Growing scratch arena to %ld B", cap)
+  }
+
+  /** @brief Hands out an aligned buffer of n values.
+   *  @tparam T The type of the values.
+   *  @param[in] n Number of values.
+   *  @return A pointer to uninitialized memory valid until the next reserve
+   *  or reset.
+   */
+  template <typename T>
+  T *allocate(size_t n)
+  {
+    const size_t bytes = footprint<T>(n);
+    CFATAL(ScratchArena,
+           offset + bytes > cap,
+           "Scratch arena exhausted (requested %ld B, %ld B of %ld B in use)",
+           bytes,
+           offset,
+           cap)
+    T *ptr = reinterpret_cast<T *>(aligned + offset);
+    offset += bytes;
+    highWater = std::max(highWater, offset);
+    return ptr;
+  }
+
+  /** @brief Invalidates all buffers handed out so far */
+  void reset() { offset = 0; }
+
+  /** @brief The number of bytes currently backing the arena */
+  size_t capacity() const { return cap; }
+
+  /** @brief The maximum number of bytes ever handed out by the arena */
+  size_t highWaterMark() const { return highWater; }
+
+  /** @brief The number of allocations the arena performed */
+  size_t allocations() const { return numGrows; }
+
+  /** @brief The resource the arena allocates from */
+  AMSResourceType getResource() const { return resource; }
+};
+
+/**
+ * @brief A set of scratch arenas shared by the threads calling into the same
+ * AMSWorkflow.
+ *
+ * @details Every evaluate call acquires an arena for its whole duration and
+ * returns it upon completion. Arenas are created on demand, so the pool holds
+ * as many arenas as the maximum number of concurrent callers and a single
+ * threaded application keeps reusing the same one.
+ */
+class ScratchPool
+{
+  /** @brief The resource the arenas allocate from */
+  AMSResourceType resource;
+
+  /** @brief All arenas created by the pool */
+  std::vector<std::unique_ptr<ScratchArena>> arenas;
+
+  /** @brief Arenas not currently used by any caller */
+  std::vector<ScratchArena *> available;
+
+  /** @brief Guards 'arenas' and 'available' */
+  mutable std::mutex mtx;
+
+  void release(ScratchArena *arena)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    available.push_back(arena);
+  }
+
+public:
+  /** @brief Exclusive access to one arena of the pool. The arena returns to
+   * the pool when the handle goes out of scope. */
+  class Handle
+  {
+    ScratchPool *pool;
+    ScratchArena *arena;
+
+  public:
+    Handle(ScratchPool *pool, ScratchArena *arena) : pool(pool), arena(arena)
+    {
+    }
+    Handle(const Handle &) = delete;
+    Handle &operator=(const Handle &) = delete;
+    Handle(Handle &&other) : pool(other.pool), arena(other.arena)
+    {
+      other.arena = nullptr;
+    }
+    ~Handle()
+    {
+      if (arena != nullptr) pool->release(arena);
+    }
+
+    ScratchArena &operator*() const { return *arena; }
+    ScratchArena *operator->() const { return arena; }
+  };
+
+  ScratchPool(AMSResourceType resource) : resource(resource) {}
+
+  ScratchPool(const ScratchPool &) = delete;
+  ScratchPool &operator=(const ScratchPool &) = delete;
+
+  /** @brief Hands out an arena no other caller is using */
+  Handle acquire()
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (available.empty()) {
+      arenas.emplace_back(new ScratchArena(resource));
+      DBG(ScratchPool, "Creating scratch arena %ld", arenas.size())
+      return Handle(this, arenas.back().get());
+    }
+    ScratchArena *arena = available.back();
+    available.pop_back();
+    return Handle(this, arena);
+  }
+
+  /** @brief The number of arenas created so far */
+  size_t size() const
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    return arenas.size();
+  }
+
+  /** @brief The number of allocations all arenas performed */
+  size_t allocations() const
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    size_t count = 0;
+    for (auto &arena : arenas)
+      count += arena->allocations();
+    return count;
+  }
+
+  /** @brief The maximum number of bytes any arena ever handed out */
+  size_t highWaterMark() const
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    size_t mark = 0;
+    for (auto &arena : arenas)
+      mark = std::max(mark, arena->highWaterMark());
+    return mark;
+  }
+
+  /** @brief The number of bytes backing all arenas */
+  size_t capacity() const
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    size_t bytes = 0;
+    for (auto &arena : arenas)
+      bytes += arena->capacity();
+    return bytes;
+  }
+};
+
+}  // namespace ams
+
+#endif
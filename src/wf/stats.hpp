@@ -0,0 +1,147 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#ifndef __AMS_STATS_HPP__
+#define __AMS_STATS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "AMS.h"
+
+namespace ams
+{
+/**
+ * @brief Counters and per stage timers of an AMSWorkflow.
+ *
+ * @details All counters are atomics, so threads evaluating the same
+ * workflow concurrently update them without locking. Reading them while
+ * evaluations are in flight returns a consistent value per counter, not a
+ * snapshot across counters.
+ */
+class WorkflowStats
+{
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> totalElements;
+  std::atomic<uint64_t> physicsElements;
+  std::atomic<uint64_t> surrogateElements;
+  std::atomic<uint64_t> bytesStored;
+  std::atomic<uint64_t> memoHits;
+  std::atomic<uint64_t> stageNs[AMSStage::StageEnd];
+  std::atomic<uint64_t> stageMaxNs[AMSStage::StageEnd];
+
+public:
+  /** @brief Measures the time between its construction and destruction and
+   * accounts it to a stage */
+  class Timer
+  {
+    WorkflowStats &stats;
+    AMSStage stage;
+    std::chrono::steady_clock::time_point start;
+    bool running;
+
+  public:
+    Timer(WorkflowStats &stats, AMSStage stage)
+        : stats(stats),
+          stage(stage),
+          start(std::chrono::steady_clock::now()),
+          running(true)
+    {
+    }
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+    ~Timer() { stop(); }
+
+    /** @brief Accounts the time measured so far, the destructor then
+     * accounts nothing */
+    void stop()
+    {
+      if (!running) return;
+      running = false;
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+      stats.addTime(stage, ns);
+    }
+  };
+
+  WorkflowStats()
+      : calls(0),
+        totalElements(0),
+        physicsElements(0),
+        surrogateElements(0),
+        bytesStored(0),
+        memoHits(0)
+  {
+    for (int i = 0; i < AMSStage::StageEnd; i++) {
+      stageNs[i] = 0;
+      stageMaxNs[i] = 0;
+    }
+  }
+
+  WorkflowStats(const WorkflowStats &) = delete;
+  WorkflowStats &operator=(const WorkflowStats &) = delete;
+
+  /** @brief Accounts an evaluate call */
+  void addCall(uint64_t total, uint64_t physics)
+  {
+    calls.fetch_add(1, std::memory_order_relaxed);
+    totalElements.fetch_add(total, std::memory_order_relaxed);
+    physicsElements.fetch_add(physics, std::memory_order_relaxed);
+  }
+
+  /** @brief Accounts elements the surrogate model was evaluated on */
+  void addSurrogate(uint64_t elements)
+  {
+    surrogateElements.fetch_add(elements, std::memory_order_relaxed);
+  }
+
+  /** @brief Accounts bytes handed to the database */
+  void addStored(uint64_t bytes)
+  {
+    bytesStored.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  /** @brief Accounts elements found in the memoization cache */
+  void addMemoHits(uint64_t elements)
+  {
+    memoHits.fetch_add(elements, std::memory_order_relaxed);
+  }
+
+  /** @brief Accounts time spent in a stage */
+  void addTime(AMSStage stage, uint64_t ns)
+  {
+    stageNs[stage].fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = stageMaxNs[stage].load(std::memory_order_relaxed);
+    while (ns > max &&
+           !stageMaxNs[stage].compare_exchange_weak(
+               max, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  /** @brief Copies the counters to the C API representation */
+  void get(AMSStats &stats) const
+  {
+    stats.calls = calls.load(std::memory_order_relaxed);
+    stats.totalElements = totalElements.load(std::memory_order_relaxed);
+    stats.physicsElements = physicsElements.load(std::memory_order_relaxed);
+    stats.surrogateElements =
+        surrogateElements.load(std::memory_order_relaxed);
+    stats.bytesStored = bytesStored.load(std::memory_order_relaxed);
+    stats.memoHits = memoHits.load(std::memory_order_relaxed);
+    for (int i = 0; i < AMSStage::StageEnd; i++) {
+      stats.stageNanoseconds[i] = stageNs[i].load(std::memory_order_relaxed);
+      stats.stageMaxNanoseconds[i] =
+          stageMaxNs[i].load(std::memory_order_relaxed);
+    }
+  }
+};
+
+}  // namespace ams
+
+#endif
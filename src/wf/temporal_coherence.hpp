@@ -0,0 +1,168 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#ifndef __AMS_TEMPORAL_COHERENCE_HPP__
+#define __AMS_TEMPORAL_COHERENCE_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "AMS.h"
+#include "ml/hdcache.hpp"
+#include "wf/debug.h"
+
+namespace ams
+{
+/**
+ * @brief Skips the nearest neighbor search of elements whose inputs moved
+ * too little since their last search to change the UQ decision.
+ *
+ * @details For every element slot (identified by the application descriptor
+ * and the position of the element) we keep an anchor: the inputs of the
+ * last search and the squared L2 distance M the decision was based on. If
+ * the inputs moved by delta from the anchor, the triangle inequality bounds
+ * every neighbor distance d of the new inputs by |d_anchor - delta| and
+ * d_anchor + delta. Hence:
+ *  - FAISSMean, M = mean(d^2): the new metric lies within
+ *    [M - 2 delta sqrt(M), (sqrt(M) + delta)^2],
+ *  - FAISSMax, M = d_k^2: the new metric lies within
+ *    [(sqrt(M) - delta)^2, (sqrt(M) + delta)^2] when sqrt(M) >= delta.
+ * When the whole interval lies on one side of the threshold the decision is
+ * known without a search. Otherwise we search and move the anchor to the
+ * current inputs. Anchors only move on a search, so the drift of many small
+ * steps accumulates in delta and eventually triggers a search.
+ *
+ * The bounds hold for exact searches (flat indices). With approximate
+ * indices they hold with respect to the neighbors the index returned last.
+ * Points added to the index only lower the metric, so once the index grows
+ * acceptances remain valid while rejections need a new search.
+ */
+template <typename FPTypeValue>
+class TemporalCoherence
+{
+  /** @brief The anchors of a contiguous range of element slots */
+  struct Slots {
+    std::mutex mtx;
+    long numElements = 0;
+    /** @brief Anchor inputs, one array of numElements values per input */
+    std::vector<FPTypeValue> anchors;
+    /** @brief The metric of the anchors */
+    std::vector<double> metric;
+    /** @brief The version of the index all rejections were computed with */
+    uint64_t version = 0;
+  };
+
+  std::mutex mtx;
+  std::map<std::pair<void *, long>, std::unique_ptr<Slots>> slots;
+
+  Slots &getSlots(void *probDescr, long slot)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto &entry = slots[std::make_pair(probDescr, slot)];
+    if (!entry) entry.reset(new Slots());
+    return *entry;
+  }
+
+public:
+  /** @brief Computes the UQ predicate of elements.
+   *  @param[in] cache The UQ module, it has to support metrics.
+   *  @param[in] probDescr The application descriptor of the elements.
+   *  @param[in] slot The position of the first element in the application
+   *  arrays.
+   *  @param[in] n The number of elements.
+   *  @param[in] inputs The inputs of the elements.
+   *  @param[out] predicate Whether each element is acceptable.
+   *  @return The number of elements that required a search.
+   */
+  long evaluate(const HDCache<FPTypeValue> &cache,
+                void *probDescr,
+                long slot,
+                long n,
+                const std::vector<const FPTypeValue *> &inputs,
+                bool *predicate)
+  {
+    const int dim = inputs.size();
+    Slots &s = getSlots(probDescr, slot);
+    std::lock_guard<std::mutex> lock(s.mtx);
+    const uint64_t version = cache.version();
+    const bool grown = (s.version != version);
+    s.version = version;
+
+    // New or resized slots are searched entirely
+    if (s.numElements != n) {
+      s.numElements = n;
+      s.anchors.resize(dim * n);
+      s.metric.resize(n);
+      cache.evaluate(n, inputs, predicate, s.metric.data());
+      for (int d = 0; d < dim; d++)
+        std::copy(inputs[d], inputs[d] + n, &s.anchors[d * n]);
+      return n;
+    }
+
+    const double thr = cache.get_threshold();
+    const bool maxPolicy = cache.get_policy() == AMSUQPolicy::FAISSMax;
+    std::vector<long> search;
+    for (long i = 0; i < n; i++) {
+      double delta2 = 0;
+      for (int d = 0; d < dim; d++) {
+        double diff = double(inputs[d][i]) - double(s.anchors[d * n + i]);
+        delta2 += diff * diff;
+      }
+      const double delta = std::sqrt(delta2);
+      const double M = s.metric[i];
+      const double rootM = std::sqrt(M);
+      const double upper = (rootM + delta) * (rootM + delta);
+      double lower;
+      if (maxPolicy)
+        lower = (rootM >= delta) ? (rootM - delta) * (rootM - delta) : 0;
+      else
+        lower = M - 2 * delta * rootM;
+
+      if (upper < thr)
+        predicate[i] = true;
+      else if (lower >= thr && !grown)
+        predicate[i] = false;
+      else
+        search.push_back(i);
+    }
+
+    const long numSearch = search.size();
+    DBG(TemporalCoherence, "Searching %ld of %ld elements", numSearch, n);
+    if (numSearch == 0) return 0;
+
+    // Gather the undecided elements, search them and move their anchors
+    std::vector<FPTypeValue> gathered(dim * numSearch);
+    std::vector<const FPTypeValue *> sInputs(dim);
+    for (int d = 0; d < dim; d++) {
+      for (long j = 0; j < numSearch; j++)
+        gathered[d * numSearch + j] = inputs[d][search[j]];
+      sInputs[d] = &gathered[d * numSearch];
+    }
+    std::unique_ptr<bool[]> sPredicate(new bool[numSearch]);
+    std::vector<double> sMetric(numSearch);
+    cache.evaluate(numSearch, sInputs, sPredicate.get(), sMetric.data());
+
+    for (long j = 0; j < numSearch; j++) {
+      const long i = search[j];
+      predicate[i] = sPredicate[j];
+      s.metric[i] = sMetric[j];
+      for (int d = 0; d < dim; d++)
+        s.anchors[d * n + i] = inputs[d][i];
+    }
+    return numSearch;
+  }
+};
+
+}  // namespace ams
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#ifndef __AMS_THREAD_POOL_HPP__
+#define __AMS_THREAD_POOL_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "wf/debug.h"
+
+namespace ams
+{
+/**
+ * @brief A fixed-size pool of host threads executing tasks in FIFO order.
+ *
+ * @details Threads are created once upon construction and live until the
+ * pool is destroyed, so submitting work does not pay any thread creation
+ * cost. Destroying the pool waits for all submitted tasks to complete.
+ */
+class ThreadPool
+{
+  /** @brief The threads of the pool */
+  std::vector<std::thread> workers;
+
+  /** @brief Tasks waiting for a thread */
+  std::deque<std::function<void()>> tasks;
+
+  std::mutex mtx;
+  /** @brief Signaled when a task is submitted or the pool is destroyed */
+  std::condition_variable cv;
+
+  /** @brief Set upon destruction to terminate the threads */
+  bool stop;
+
+  /** @brief The main loop of every thread in the pool */
+  void work()
+  {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() { return stop || !tasks.empty(); });
+        if (tasks.empty()) return;
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  /** @brief Creates the pool.
+   *  @param[in] nThreads The number of threads. When 0 the pool uses as
+   *  many threads as the hardware supports.
+   */
+  explicit ThreadPool(size_t nThreads) : stop(false)
+  {
+    if (nThreads == 0)
+      nThreads = std::max(1u, std::thread::hardware_concurrency());
+    DBG(ThreadPool, "Creating thread pool with %ld threads", nThreads)
+    for (size_t i = 0; i < nThreads; i++)
+      workers.emplace_back(&ThreadPool::work, this);
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stop = true;
+    }
+    cv.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  /** @brief The number of threads in the pool */
+  size_t size() const { return workers.size(); }
+
+  /** @brief A process wide pool for the data parallel kernels of the
+   * library, such as nearest neighbor searches. Together with the calling
+   * thread it uses every hardware thread. Its own tasks must not call
+   * parallel_for on it, they would wait for helpers queued behind them.
+   */
+  static ThreadPool &shared()
+  {
+    static ThreadPool threads(
+        std::max(2u, std::thread::hardware_concurrency()) - 1);
+    return threads;
+  }
+
+  /** @brief Schedules a callable to run on one of the threads of the pool.
+   *  @param[in] fn The callable to execute.
+   *  @return A future that becomes ready once 'fn' completes and rethrows
+   *  any exception 'fn' threw.
+   */
+  template <typename Fn>
+  std::future<void> submit(Fn &&fn)
+  {
+    auto task =
+        std::make_shared<std::packaged_task<void()>>(std::forward<Fn>(fn));
+    std::future<void> result = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      tasks.emplace_back([task]() { (*task)(); });
+    }
+    cv.notify_one();
+    return result;
+  }
+
+  /** @brief Applies a callable to consecutive ranges of [0, n) in parallel.
+   *  @param[in] n The number of iterations.
+   *  @param[in] grain The maximum number of iterations of a range.
+   *  @param[in] fn A callable invoked as fn(begin, end) on disjoint ranges.
+   *  It has to be safe to invoke concurrently.
+   *
+   *  @details Ranges are claimed dynamically, so threads that finish their
+   *  ranges early keep taking work from the slower ones. The calling thread
+   *  participates in the computation and the function returns once all
+   *  ranges are done, rethrowing the first exception 'fn' threw.
+   */
+  template <typename Fn>
+  void parallel_for(size_t n, size_t grain, Fn &&fn)
+  {
+    if (n == 0) return;
+    grain = std::max(grain, static_cast<size_t>(1));
+    const size_t numChunks = (n + grain - 1) / grain;
+
+    std::atomic<size_t> next(0);
+    auto run = [&]() {
+      size_t chunk;
+      while ((chunk = next.fetch_add(1)) < numChunks) {
+        size_t begin = chunk * grain;
+        fn(begin, std::min(begin + grain, n));
+      }
+    };
+
+    std::vector<std::future<void>> helpers;
+    const size_t numHelpers = std::min(workers.size(), numChunks - 1);
+    for (size_t i = 0; i < numHelpers; i++)
+      helpers.push_back(submit(run));
+
+    std::exception_ptr error;
+    try {
+      run();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    // Helpers reference our stack, wait for all of them before leaving.
+    for (auto &helper : helpers) {
+      try {
+        helper.get();
+      } catch (...) {
+        if (!error) error = std::current_exception();
+      }
+    }
+    if (error) std::rethrow_exception(error);
+  }
+};
+
+}  // namespace ams
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#ifndef __AMS_THRESHOLD_CONTROLLER_HPP__
+#define __AMS_THRESHOLD_CONTROLLER_HPP__
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include "wf/debug.h"
+
+namespace ams
+{
+/**
+ * @brief A feedback controller adjusting the UQ threshold after every
+ * evaluate call to track a physics budget.
+ *
+ * @details The budget is either the fraction of elements computed by the
+ * physics module or the duration of an evaluate call. Raising the threshold
+ * accepts more elements, so the controller multiplies the threshold by the
+ * ratio of the observed value to the budget raised to 'gain', i.e. it is a
+ * proportional controller in log space. A single update changes the
+ * threshold by at most 'maxStep' times and the threshold never leaves
+ * [minThreshold, maxThreshold], which bounds the error of the surrogate.
+ * A threshold of 0 would remain 0, so the lower bound is at least
+ * minFloor().
+ */
+class ThresholdController
+{
+  /** @brief Target fraction of elements computed by the physics module.
+   * Ignored when 0 */
+  const double targetFraction;
+
+  /** @brief Target duration of an evaluate call in seconds. Ignored when 0 */
+  const double timeBudget;
+
+  /** @brief Lower bound of the threshold */
+  const double minThreshold;
+
+  /** @brief Upper bound of the threshold */
+  const double maxThreshold;
+
+  /** @brief Exponent applied to the observed / target ratio */
+  const double gain;
+
+  /** @brief Maximum factor by which a single update changes the threshold */
+  const double maxStep;
+
+  /** @brief The current threshold */
+  double threshold;
+
+  std::mutex mtx;
+
+public:
+  /** @brief The smallest lower bound of the threshold */
+  static double minFloor() { return std::numeric_limits<float>::epsilon(); }
+
+  ThresholdController(double threshold,
+                      double targetFraction,
+                      double timeBudget,
+                      double minThreshold,
+                      double maxThreshold,
+                      double gain = 0.5,
+                      double maxStep = 2.0)
+      : targetFraction(targetFraction),
+        timeBudget(timeBudget),
+        minThreshold(std::max(minThreshold, minFloor())),
+        maxThreshold(std::max(this->minThreshold, maxThreshold)),
+        gain(gain),
+        maxStep(maxStep),
+        threshold(threshold)
+  {
+    CFATAL(ThresholdController,
+           targetFraction <= 0 && timeBudget <= 0,
+           "Threshold controller requires a physics fraction or a time budget")
+    this->threshold = std::min(std::max(threshold, this->minThreshold),
+                               this->maxThreshold);
+  }
+
+  /** @brief Computes the threshold of the next evaluate call.
+   *  @param[in] physicsElements Elements the physics module computed.
+   *  @param[in] totalElements Elements of the call.
+   *  @param[in] seconds Duration of the call.
+   *  @return The new threshold.
+   */
+  double update(long physicsElements, long totalElements, double seconds)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (totalElements <= 0) return threshold;
+
+    // With both targets, follow the one we violate the most
+    double ratio = 0;
+    if (targetFraction > 0)
+      ratio = (double(physicsElements) / double(totalElements)) /
+              targetFraction;
+    if (timeBudget > 0) ratio = std::max(ratio, seconds / timeBudget);
+
+    ratio = std::min(std::max(ratio, 1.0 / maxStep), maxStep);
+    double factor =
+        std::min(std::max(std::pow(ratio, gain), 1.0 / maxStep), maxStep);
+    threshold = std::min(std::max(threshold * factor, minThreshold),
+                         maxThreshold);
+    DBG(ThresholdController,
+        "Physics %ld/%ld in %f s, threshold set to %f",
+        physicsElements,
+        totalElements,
+        seconds,
+        threshold)
+    return threshold;
+  }
+
+  /** @brief The current threshold */
+  double getThreshold()
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    return threshold;
+  }
+};
+
+}  // namespace ams
+
+#endif
@@ -8,11 +8,22 @@
 #ifndef __AMS_WORKFLOW_HPP__
 #define __AMS_WORKFLOW_HPP__
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "AMS.h"
@@ -20,6 +31,12 @@
 #include "ml/surrogate.hpp"
 
 #include "wf/basedb.hpp"
+#include "wf/memoization.hpp"
+#include "wf/scratch_arena.hpp"
+#include "wf/stats.hpp"
+#include "wf/temporal_coherence.hpp"
+#include "wf/thread_pool.hpp"
+#include "wf/threshold_controller.hpp"
 
 #ifdef __ENABLE_MPI__
 #include "wf/redist_load.hpp"
@@ -85,6 +102,135 @@ class AMSWorkflow
   /** @brief execution policy of the distributed system. Load balance or not. */
   const AMSExecPolicy ePolicy;
 
+  /** @brief Whether to run the surrogate on all elements or only on the
+   * elements accepted by the UQ module */
+  AMSInferencePolicy infPolicy;
+
+  /** @brief When infPolicy is AdaptiveInference the surrogate runs only on
+   * the accepted elements if they are fewer than this fraction of the
+   * elements */
+  double selectiveRatio;
+
+  /** @brief A dedicated thread running the surrogate model while the
+   * calling thread runs the physics module. Only used on the CPU when
+   * concurrent execution is enabled */
+  std::unique_ptr<ams::ThreadPool> inferencePool;
+
+  /** @brief Threads invoking the physics module on chunks of the rejected
+   * elements. Only used on the CPU when parallel physics is enabled */
+  std::unique_ptr<ams::ThreadPool> physicsPool;
+
+  /** @brief Number of elements passed to each call of the physics module
+   * when physicsPool is set */
+  long physicsGrain;
+
+  /** @brief Returns the outputs of previously seen inputs without running
+   * UQ, the surrogate or the physics module. It is created by the first
+   * evaluate call, once the dimensions are known */
+  std::unique_ptr<ams::MemoizationCache<FPTypeValue>> memo;
+  std::once_flag memoCreated;
+
+  /** @brief Number of elements of the memoization cache. When 0 memoization
+   * is disabled */
+  long memoCapacity;
+
+  /** @brief Quantization step of the memoized inputs */
+  double memoTolerance;
+
+  /** @brief Whether to memoize only the outputs of the physics module */
+  bool memoPhysicsOnly;
+
+  /** @brief Number of physics inputs collected before they are added to
+   * the UQ index. When 0 the index does not grow */
+  long uqAddBatch;
+
+  /** @brief Inputs closer than this to the index are not added */
+  double uqAddRadius;
+
+  /** @brief The index stops growing once it holds this many points. No
+   * limit when 0 */
+  long uqMaxPoints;
+
+  /** @brief When larger than 0, the first evaluate call picks the UQ search
+   * parameters that find this fraction of the nearest neighbors */
+  double uqTargetRecall;
+  std::once_flag uqCalibrated;
+
+  /** @brief Physics inputs waiting to be added to the UQ index, one array
+   * per input */
+  std::vector<std::vector<FPTypeValue>> uqPending;
+
+  /** @brief Guards uqPending */
+  std::mutex uqPendingMtx;
+
+  /** @brief Skips the UQ search of elements whose inputs barely changed
+   * since the previous calls. Not set when disabled */
+  std::unique_ptr<ams::TemporalCoherence<FPTypeValue>> temporal;
+
+  /** @brief How the surrogate model and the UQ module are loaded */
+  AMSLoadPolicy loadPolicy;
+
+  /** @brief Completes once the surrogate model and the UQ module are loaded
+   * in the background. Not valid when they are loaded by the constructor */
+  std::shared_future<void> loading;
+
+  /** @brief Set once evaluate waited for 'loading', so later calls do not
+   * check it again. Balanced ranks set it on the same call */
+  mutable std::atomic<bool> loadingDone{false};
+
+  /** @brief Guards 'loaded' and 'onLoaded' */
+  std::mutex loadMtx;
+
+  /** @brief Whether the surrogate model and the UQ module are loaded */
+  bool loaded;
+
+  /** @brief Configuration steps waiting for the surrogate model and the UQ
+   * module to be loaded */
+  std::vector<std::function<void()>> onLoaded;
+
+  /** @brief The path of the surrogate model given at construction */
+  std::string modelPath;
+
+  /** @brief Polls for new surrogate models and stages them. Not running
+   * when reloading is disabled */
+  std::thread reloader;
+
+  /** @brief Guards 'stopReload' */
+  std::mutex reloadMtx;
+
+  /** @brief Signaled to stop the reloader */
+  std::condition_variable reloadCv;
+
+  /** @brief Set to terminate the reloader */
+  bool stopReload;
+
+  /** @brief Set when the reloader staged a new surrogate model. The next
+   * evaluate call swaps it in */
+  std::atomic<bool> modelStaged;
+
+  /** @brief Counters and stage timers reported through AMSGetStats */
+  ams::WorkflowStats stats;
+
+  /** @brief Adjusts the UQ threshold after every evaluate call to track a
+   * physics budget. Not set when the threshold is fixed */
+  std::unique_ptr<ams::ThresholdController> thresholdController;
+
+  /** @brief Maximum number of elements evaluate processes at once. When 0
+   * all elements are processed at once */
+  long tileSize;
+
+  /** @brief Grow-only memory holding the temporaries of evaluate. Every
+   * concurrent caller uses its own arena; arenas are sized by the first calls
+   * and reused afterwards */
+  ams::ScratchPool scratchPool;
+
+  /** @brief Serializes stores of concurrent evaluate calls to databases that
+   * are not thread safe */
+  std::mutex dbMtx;
+
+  /** @brief Whether DB is an AsyncDB, which accepts concurrent stores */
+  bool dbIsAsync;
+
   /** \brief Store the data in the database and copies
    * data from the GPU to the CPU and then to the database.
    * To store GPU resident data we use a 1MB of "pinned"
@@ -111,8 +257,14 @@ class AMSWorkflow
     if (DB == nullptr)
       return;
 
+    ams::WorkflowStats::Timer timer(stats, AMSStage::StageDBStore);
+    stats.addStored(num_elements * (numIn + numOut) * sizeof(FPTypeValue));
+
     std::vector<FPTypeValue *> hInputs, hOutputs;
 
+    std::unique_lock<std::mutex> lock(dbMtx, std::defer_lock);
+    if (!dbIsAsync) lock.lock();
+
     if (isCPU) return DB->store(num_elements, inputs, outputs);
 
     // Compute number of elements that fit inside the buffer
@@ -132,7 +284,7 @@ class AMSWorkflow
       hOutputs.push_back(&pPtr[(i + inputs.size()) * elPerDim]);
 
     // Iterate over all chunks
-    for (int i = 0; i < num_elements; i += elPerDim) {
+    for (size_t i = 0; i < num_elements; i += elPerDim) {
       size_t actualElems = std::min(elPerDim, num_elements - i);
       // Copy input data to host
       for (int k = 0; k < numIn; k++) {
@@ -140,7 +292,7 @@ class AMSWorkflow
       }
 
       // Copy output data to host
-      for (int k = 0; k < numIn; k++) {
+      for (int k = 0; k < numOut; k++) {
         ams::ResourceManager::copy(&outputs[k][i], hOutputs[k], actualElems * sizeof(FPTypeValue));
       }
 
@@ -152,6 +304,294 @@ class AMSWorkflow
     return;
   }
 
+  /** @brief Creates the surrogate model and the UQ module and applies the
+   * configuration steps that were waiting for them */
+  void loadModels(const std::string &uqPath,
+                  const std::string &surrogatePath,
+                  FPTypeValue threshold,
+                  const AMSUQPolicy uqPolicy,
+                  const int nClusters)
+  {
+    CALIPER(CALI_MARK_BEGIN("LOAD MODELS");)
+    if (!surrogatePath.empty())
+      surrogate =
+          new SurrogateModel<FPTypeValue>(surrogatePath.c_str(), isCPU);
+
+    // TODO: Fix magic number. 10 represents the number of neighbours I am
+    // looking at.
+    if (!uqPath.empty())
+      hdcache = new HDCache<FPTypeValue>(uqPath, !isCPU,
+          uqPolicy, nClusters, threshold);
+    else
+      // This is a random hdcache returning true %threshold queries
+      hdcache = new HDCache<FPTypeValue>(!isCPU, threshold);
+    CALIPER(CALI_MARK_END("LOAD MODELS");)
+
+    std::lock_guard<std::mutex> lock(loadMtx);
+    loaded = true;
+    for (auto &fn : onLoaded)
+      fn();
+    onLoaded.clear();
+  }
+
+  /** @brief Runs a configuration step that needs the surrogate model or the
+   * UQ module, right away or once they are loaded in the background */
+  void runWhenLoaded(std::function<void()> fn)
+  {
+    std::lock_guard<std::mutex> lock(loadMtx);
+    if (loaded)
+      fn();
+    else
+      onLoaded.push_back(std::move(fn));
+  }
+
+  /** @brief Whether evaluate can use the surrogate model and the UQ module.
+   * Waits for background loading to complete, unless the load policy falls
+   * back to the physics module while loading.
+   * @param[in] Comm The communicator of the ranks balancing their loads.
+   * Balanced ranks take the same path, the models are used once all of them
+   * loaded them. */
+  bool modelsReady(MPI_Comm Comm = nullptr) const
+  {
+    if (!loading.valid() || loadingDone.load(std::memory_order_acquire))
+      return true;
+    int ready = loadPolicy != AMSLoadPolicy::AsyncLoadFallback ||
+                loading.wait_for(std::chrono::seconds(0)) ==
+                    std::future_status::ready;
+#ifdef __ENABLE_MPI__
+    if (ePolicy == AMSExecPolicy::BALANCED && Comm) {
+      int local = ready;
+      MPI_Allreduce(&local, &ready, 1, MPI_INT, MPI_LAND, Comm);
+    }
+#endif
+    if (!ready) return false;
+    loading.get();
+    loadingDone.store(true, std::memory_order_release);
+    return true;
+  }
+
+  /** @brief The main loop of the reloader thread. Stages a new surrogate
+   * model when the watched file is modified or when the database receives a
+   * reload message, which may name the model to load.
+   * @param[in] watchPath The model file to watch.
+   * @param[in] period The time between two checks.
+   */
+  void reloadModels(const std::string watchPath,
+                    const std::chrono::milliseconds period)
+  {
+    const std::string prefix("ams-reload-model");
+    std::error_code ec;
+    auto lastWrite = fs::last_write_time(watchPath, ec);
+    std::unique_lock<std::mutex> lock(reloadMtx);
+    while (!reloadCv.wait_for(lock, period, [&]() { return stopReload; })) {
+      lock.unlock();
+      std::string path, message;
+      if (DB != nullptr && DB->pop_message(prefix, message)) {
+        path = message.substr(prefix.size());
+        path.erase(0, path.find_first_not_of(" \t\n"));
+        path.erase(path.find_last_not_of(" \t\n") + 1);
+        if (path.empty()) path = watchPath;
+      } else {
+        auto lastModified = fs::last_write_time(watchPath, ec);
+        if (!ec && lastModified != lastWrite) {
+          lastWrite = lastModified;
+          path = watchPath;
+        }
+      }
+      if (!path.empty()) {
+        DBG(Workflow, "Loading surrogate model %s", path.c_str());
+        CALIPER(CALI_MARK_BEGIN("RELOAD MODEL");)
+        if (surrogate->stage(path)) modelStaged = true;
+        CALIPER(CALI_MARK_END("RELOAD MODEL");)
+      }
+      lock.lock();
+    }
+  }
+
+  /** @brief Stops the reloader, a model it staged is still swapped in */
+  void stopReloader()
+  {
+    if (!reloader.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(reloadMtx);
+      stopReload = true;
+    }
+    reloadCv.notify_all();
+    reloader.join();
+    stopReload = false;
+  }
+
+  /** @brief Replaces the surrogate model with the one the reloader staged.
+   * Called at the beginning of evaluate calls, so all tiles of a call use
+   * the same model */
+  void swapStagedModel()
+  {
+    if (!modelStaged.load(std::memory_order_relaxed)) return;
+    if (!modelStaged.exchange(false) || !surrogate->swap()) return;
+    // Memoized outputs of the previous model are stale
+    if (memo && !memoPhysicsOnly) memo->clear();
+    CINFO(Workflow, rId == 0, "Swapped in a new surrogate model")
+  }
+
+  /** @brief Calibrates the UQ search parameters on a strided sample of the
+   * inputs of an evaluate call.
+   * @param[in] numElements The number of elements
+   * @param[in] inputs The inputs of the elements
+   */
+  void calibrateUQ(long numElements,
+                   const std::vector<const FPTypeValue *> &inputs)
+  {
+    // Enough queries to measure the recall, few enough to calibrate quickly
+    const long numSamples = std::min(numElements, 4096L);
+    if (numSamples == 0) return;
+    const long stride = numElements / numSamples;
+    std::vector<std::vector<FPTypeValue>> samples(
+        inputs.size(), std::vector<FPTypeValue>(numSamples));
+    std::vector<const FPTypeValue *> sInputs;
+    for (size_t i = 0; i < inputs.size(); i++) {
+      for (long j = 0; j < numSamples; j++)
+        samples[i][j] = inputs[i][j * stride];
+      sInputs.push_back(samples[i].data());
+    }
+    std::string params =
+        hdcache->calibrate(numSamples, sInputs, uqTargetRecall);
+    CINFO(Workflow,
+          rId == 0 && !params.empty(),
+          "Calibrated UQ searches to '%s'",
+          params.c_str())
+  }
+
+  /** @brief Collects the inputs computed by the physics module and adds
+   * them to the UQ index once a batch is complete.
+   * @param[in] numElements The number of elements
+   * @param[in] inputs The inputs of the elements
+   */
+  void growUQ(long numElements, std::vector<FPTypeValue *> &inputs)
+  {
+    if (uqAddBatch <= 0 || numElements == 0 || hdcache == nullptr) return;
+    if (uqMaxPoints > 0 &&
+        hdcache->count() >= static_cast<size_t>(uqMaxPoints))
+      return;
+
+    std::vector<std::vector<FPTypeValue>> batch;
+    {
+      std::lock_guard<std::mutex> lock(uqPendingMtx);
+      uqPending.resize(inputs.size());
+      for (size_t i = 0; i < inputs.size(); i++)
+        uqPending[i].insert(
+            uqPending[i].end(), inputs[i], inputs[i] + numElements);
+      if (uqPending[0].size() < static_cast<size_t>(uqAddBatch)) return;
+      batch.swap(uqPending);
+    }
+
+    // Evaluations wait for the index while points are added
+    ams::WorkflowStats::Timer timer(stats, AMSStage::StageUQ);
+    CALIPER(CALI_MARK_BEGIN("UQ_GROW");)
+    std::vector<const FPTypeValue *> bInputs;
+    for (auto &values : batch)
+      bInputs.push_back(values.data());
+    size_t added = hdcache->add(batch[0].size(), bInputs, uqAddRadius, uqMaxPoints);
+    CALIPER(CALI_MARK_END("UQ_GROW");)
+    (void)added;
+    DBG(Workflow,
+        "Added %ld of %ld physics inputs to the UQ index (%ld points)",
+        added,
+        batch[0].size(),
+        hdcache->count());
+  }
+
+  /** @brief Feed the outcome of an evaluate call to the threshold
+   * controller and update the threshold of the UQ module.
+   * @param[in] physicsElements Elements computed by the physics module
+   * @param[in] totalElements Elements of the call
+   * @param[in] start The time the call started
+   */
+  void adaptThreshold(long physicsElements,
+                      long totalElements,
+                      std::chrono::steady_clock::time_point start)
+  {
+    if (!thresholdController || hdcache == nullptr) return;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    double threshold = thresholdController->update(physicsElements,
+                                                   totalElements,
+                                                   elapsed.count());
+    hdcache->set_threshold(threshold);
+  }
+
+  /** @brief Decide whether to run the surrogate only on the accepted
+   * elements.
+   * @param[in] mlElements The number of elements accepted by the UQ module
+   * @param[in] totalElements The total number of elements
+   */
+  bool useSelectiveInference(long mlElements, long totalElements) const
+  {
+    switch (infPolicy) {
+      case AMSInferencePolicy::SelectiveInference:
+        return true;
+      case AMSInferencePolicy::AdaptiveInference:
+        return mlElements < selectiveRatio * totalElements;
+      default:
+        return false;
+    }
+  }
+
+  /** @brief Evaluate the surrogate model on the accepted elements.
+   * @param[in] predicate The UQ predicate (true for accepted elements)
+   * @param[in] totalElements The total number of elements
+   * @param[in] packedElements The number of rejected elements, packed at
+   * the beginning of the packed buffers
+   * @param[in] origInputs The application inputs
+   * @param[out] origOutputs The application outputs
+   * @param[in] packedInputs Packed inputs holding totalElements values. The
+   * accepted elements may be packed after the rejected ones.
+   * @param[in] packedOutputs Packed outputs holding totalElements values.
+   */
+  void evaluateSurrogate(const bool *predicate,
+                         long totalElements,
+                         long packedElements,
+                         std::vector<const FPTypeValue *> &origInputs,
+                         std::vector<FPTypeValue *> &origOutputs,
+                         std::vector<FPTypeValue *> &packedInputs,
+                         std::vector<FPTypeValue *> &packedOutputs)
+  {
+    const long mlElements = totalElements - packedElements;
+    const int inputDim = origInputs.size();
+    const int outputDim = origOutputs.size();
+
+    if (totalElements == 0) return;
+
+    ams::WorkflowStats::Timer timer(stats, AMSStage::StageSurrogate);
+    CALIPER(CALI_MARK_BEGIN("SURROGATE");)
+    if (useSelectiveInference(mlElements, totalElements)) {
+      DBG(Workflow,
+          "Model exists, I am calling surrogate (for %ld accepted items)",
+          mlElements);
+      std::vector<FPTypeValue *> mlInputs, mlOutputs;
+      for (int i = 0; i < inputDim; i++)
+        mlInputs.push_back(packedInputs[i] + packedElements);
+      for (int i = 0; i < outputDim; i++)
+        mlOutputs.push_back(packedOutputs[i] + packedElements);
+
+      data_handler::pack(predicate, totalElements, origInputs, mlInputs, true);
+      if (mlElements > 0) {
+        std::vector<const FPTypeValue *> cmlInputs(mlInputs.begin(),
+                                                   mlInputs.end());
+        surrogate->evaluate(mlElements, cmlInputs, mlOutputs);
+        stats.addSurrogate(mlElements);
+      }
+      data_handler::unpack(
+          predicate, totalElements, mlOutputs, origOutputs, true);
+    } else {
+      // The model is cheaper than packing the accepted elements,
+      // call it on all data values and overwrite the rejected ones later.
+      DBG(Workflow, "Model exists, I am calling surrogate (for all data)");
+      surrogate->evaluate(totalElements, origInputs, origOutputs);
+      stats.addSurrogate(totalElements);
+    }
+    CALIPER(CALI_MARK_END("SURROGATE");)
+  }
+
 public:
   AMSWorkflow()
       : AppCall(nullptr),
@@ -161,7 +601,24 @@ public:
         dbType(AMSDBType::None),
         isCPU(false),
         mLoc(AMSResourceType::DEVICE),
-        ePolicy(AMSExecPolicy::UBALANCED)
+        ePolicy(AMSExecPolicy::UBALANCED),
+        infPolicy(AMSInferencePolicy::FullInference),
+        selectiveRatio(0.5),
+        physicsGrain(1024),
+        memoCapacity(0),
+        memoTolerance(0),
+        memoPhysicsOnly(false),
+        uqAddBatch(0),
+        uqAddRadius(0),
+        uqMaxPoints(0),
+        uqTargetRecall(0),
+        loadPolicy(AMSLoadPolicy::SyncLoad),
+        loaded(true),
+        stopReload(false),
+        modelStaged(false),
+        tileSize(0),
+        scratchPool(AMSResourceType::DEVICE),
+        dbIsAsync(false)
   {
     if (isCPU){
       mLoc = AMSResourceType::HOST;
@@ -184,31 +641,57 @@ public:
               const int nClusters,
               int _pId = 0,
               int _wSize = 1,
-              AMSExecPolicy policy= AMSExecPolicy::UBALANCED)
+              AMSExecPolicy policy= AMSExecPolicy::UBALANCED,
+              AMSLoadPolicy loadPolicy = AMSLoadPolicy::SyncLoad)
       : AppCall(_AppCall),
         dbType(dbType),
         rId(_pId),
         wSize(_wSize),
         isCPU(is_cpu),
         mLoc(AMSResourceType::DEVICE),
-        ePolicy(policy)
+        ePolicy(policy),
+        infPolicy(AMSInferencePolicy::FullInference),
+        selectiveRatio(0.5),
+        physicsGrain(1024),
+        memoCapacity(0),
+        memoTolerance(0),
+        memoPhysicsOnly(false),
+        uqAddBatch(0),
+        uqAddRadius(0),
+        uqMaxPoints(0),
+        uqTargetRecall(0),
+        loadPolicy(loadPolicy),
+        loaded(false),
+        stopReload(false),
+        modelStaged(false),
+        tileSize(0),
+        scratchPool(is_cpu ? AMSResourceType::HOST : AMSResourceType::DEVICE),
+        dbIsAsync(false)
   {
     if (isCPU){
       mLoc = AMSResourceType::HOST;
     }
 
     surrogate = nullptr;
-    if (surrogate_path != nullptr)
-      surrogate = new SurrogateModel<FPTypeValue>(surrogate_path, is_cpu);
-
-    // TODO: Fix magic number. 10 represents the number of neighbours I am
-    // looking at.
-    if (uq_path != nullptr)
-      hdcache = new HDCache<FPTypeValue>(uq_path, !is_cpu,
-          uqPolicy, nClusters, threshold);
-    else
-      // This is a random hdcache returning true %threshold queries
-      hdcache = new HDCache<FPTypeValue>(!is_cpu, threshold);
+    hdcache = nullptr;
+    // The paths may not outlive the constructor
+    std::string uqPath = (uq_path != nullptr) ? uq_path : "";
+    std::string surrogatePath = (surrogate_path != nullptr) ? surrogate_path : "";
+    modelPath = surrogatePath;
+    if (loadPolicy == AMSLoadPolicy::SyncLoad) {
+      loadModels(uqPath, surrogatePath, threshold, uqPolicy, nClusters);
+    } else {
+      DBG(Workflow, "Loading surrogate model and UQ module in the background");
+      loading = std::async(std::launch::async,
+                           [=]() {
+                             loadModels(uqPath,
+                                        surrogatePath,
+                                        threshold,
+                                        uqPolicy,
+                                        nClusters);
+                           })
+                    .share();
+    }
 
     DB = nullptr;
     if (db_path != nullptr) {
@@ -226,9 +709,308 @@ public:
 
   void set_hdcache(HDCache<FPTypeValue> *_hdcache) { hdcache = _hdcache; }
 
+  /** @brief Select the elements the surrogate model is evaluated on.
+   * @param[in] policy The inference policy.
+   * @param[in] ratio Accepted fraction below which AdaptiveInference runs
+   * the model only on accepted elements. Values outside (0, 1] keep the
+   * default (0.5).
+   */
+  void set_inference_policy(AMSInferencePolicy policy, double ratio)
+  {
+    infPolicy = policy;
+    if (ratio > 0 && ratio <= 1) selectiveRatio = ratio;
+  }
+
+  /** @brief Run the surrogate model concurrently with the physics module.
+   * Only supported when executing on the CPU.
+   * @param[in] enable Whether to overlap the two.
+   */
+  void set_concurrent_inference(bool enable)
+  {
+    if (!enable) {
+      inferencePool.reset();
+      return;
+    }
+    CWARNING(Workflow,
+             !isCPU,
+             "Concurrent inference is only supported on the CPU, ignoring")
+    if (isCPU && !inferencePool)
+      inferencePool = std::unique_ptr<ams::ThreadPool>(new ams::ThreadPool(1));
+  }
+
+  /** @brief Let AMS invoke the physics module in parallel on disjoint
+   * chunks of the rejected elements. Only supported when executing on the
+   * CPU. The physics module has to be reentrant for disjoint ranges.
+   * @param[in] nThreads The number of threads, including the calling one.
+   * When 0 or 1 physics is invoked once on all rejected elements by the
+   * calling thread.
+   * @param[in] grain The number of elements of every chunk. Values smaller
+   * than 1 keep the default (1024).
+   */
+  void set_parallel_physics(int nThreads, long grain)
+  {
+    if (grain > 0) physicsGrain = grain;
+    // The calling thread takes chunks as well
+    if (nThreads <= 1) {
+      physicsPool.reset();
+      return;
+    }
+    CWARNING(Workflow,
+             !isCPU,
+             "Parallel physics is only supported on the CPU, ignoring")
+    if (!isCPU) return;
+    physicsPool = std::unique_ptr<ams::ThreadPool>(
+        new ams::ThreadPool(nThreads - 1));
+  }
+
+  /** @brief Adjust the UQ threshold after every evaluate call to track a
+   * physics budget.
+   * @param[in] targetFraction Target fraction of elements computed by the
+   * physics module. Ignored when 0.
+   * @param[in] timeBudget Target duration of an evaluate call in seconds.
+   * Ignored when 0.
+   * @param[in] minThreshold The smallest threshold the controller may set,
+   * at least the float epsilon since a threshold of 0 could not grow.
+   * @param[in] maxThreshold The largest threshold the controller may set.
+   * When 0 the threshold is not bounded from above.
+   * When both targets are 0 the threshold remains fixed.
+   */
+  void set_threshold_controller(double targetFraction,
+                                double timeBudget,
+                                double minThreshold,
+                                double maxThreshold)
+  {
+    if (targetFraction <= 0 && timeBudget <= 0) {
+      thresholdController.reset();
+      return;
+    }
+    if (maxThreshold <= 0) maxThreshold = std::numeric_limits<double>::max();
+    runWhenLoaded([=]() {
+      CFATAL(Workflow,
+             hdcache == nullptr,
+             "Adapting the threshold requires a UQ module")
+      thresholdController = std::unique_ptr<ams::ThresholdController>(
+          new ams::ThresholdController(hdcache->get_threshold(),
+                                       targetFraction,
+                                       timeBudget,
+                                       minThreshold,
+                                       maxThreshold));
+    });
+  }
+
+  /** @brief Copies the statistics of the workflow to 'out' */
+  void getStats(AMSStats &out) const
+  {
+    stats.get(out);
+    out.allocations = scratchPool.allocations();
+    out.scratchHighWaterBytes = scratchPool.highWaterMark();
+  }
+
+  /** @brief Return the outputs of previously seen inputs directly. Only
+   * supported when executing on the CPU.
+   * @param[in] capacity The number of elements the cache holds. When 0
+   * memoization is disabled.
+   * @param[in] tolerance Inputs are quantized with this step before they
+   * are compared. When 0 inputs need to match exactly.
+   * @param[in] physicsOnly Whether to memoize only outputs computed by the
+   * physics module.
+   */
+  void set_memoization(long capacity, double tolerance, bool physicsOnly)
+  {
+    CWARNING(Workflow,
+             capacity > 0 && !isCPU,
+             "Memoization is only supported on the CPU, ignoring")
+    memoCapacity = isCPU ? std::max(0L, capacity) : 0;
+    memoTolerance = std::max(0.0, tolerance);
+    memoPhysicsOnly = physicsOnly;
+  }
+
+  /** @brief Skip the nearest neighbor search of elements whose inputs moved
+   * too little since their last search to change the UQ decision. Element
+   * slots are identified by the application descriptor and the position of
+   * the elements, so the application has to pass the same elements in the
+   * same order across calls. Requires a host resident L2 FAISS index.
+   * Ignored while memoizing, which reorders elements.
+   * @param[in] enable Whether to track the elements across calls.
+   */
+  void set_temporal_coherence(bool enable)
+  {
+    if (!enable) {
+      temporal.reset();
+      return;
+    }
+    runWhenLoaded([=]() {
+      if (hdcache == nullptr || !hdcache->supports_metric()) {
+        CWARNING(Workflow,
+                 true,
+                 "Temporal coherence requires a host L2 FAISS index, ignoring")
+        return;
+      }
+      temporal = std::unique_ptr<ams::TemporalCoherence<FPTypeValue>>(
+          new ams::TemporalCoherence<FPTypeValue>());
+    });
+  }
+
+  /** @brief Configures the searches of a FAISS UQ index.
+   * @param[in] params FAISS search parameters, such as "nprobe=16" for IVF
+   * or "efSearch=64" for HNSW indices. Not used when null or empty.
+   * @param[in] recall When larger than 0, the first evaluate call picks the
+   * cheapest parameters finding this fraction of the nearest neighbors on a
+   * sample of its inputs, replacing 'params' (CPU only).
+   * @param[in] memoryBudget The memory the index may use in MiB. Larger
+   * indices are compressed. No limit when 0.
+   */
+  void set_uq_search(const char *params, double recall, long memoryBudget)
+  {
+    const std::string searchParams(params ? params : "");
+    const size_t budget = std::max(0L, memoryBudget) * size_t(1024 * 1024);
+    CWARNING(Workflow,
+             recall > 0 && !isCPU,
+             "Calibrating UQ searches is only supported on the CPU, ignoring")
+    runWhenLoaded([=]() {
+      if (hdcache == nullptr || hdcache->is_random()) return;
+      if (!searchParams.empty() || budget > 0)
+        hdcache->set_index_options(searchParams, budget);
+      if (recall > 0 && isCPU) uqTargetRecall = recall;
+      CINFO(Workflow,
+            rId == 0,
+            "The UQ index uses %.1f MiB",
+            hdcache->footprint() / (1024.0 * 1024.0))
+    });
+  }
+
+  /** @brief Sets the number of elements every thread of a host UQ search
+   * processes at once.
+   * @param[in] elements The chunk size. When 0 it is chosen from the
+   * number of elements and threads.
+   */
+  void set_uq_search_chunk(long elements)
+  {
+    runWhenLoaded([=]() {
+      if (hdcache != nullptr) hdcache->set_search_chunk(std::max(0L, elements));
+    });
+  }
+
+  /** @brief Runs the UQ module and the surrogate model on synthetic inputs
+   * so that the first evaluate call runs at steady-state latency.
+   * @param[in] batchSizes The numbers of elements to warm up with. Using
+   * the sizes of the application calls also warms up shape specific
+   * TorchScript optimizations.
+   */
+  void warmup(const std::vector<long> &batchSizes)
+  {
+    if (batchSizes.empty()) return;
+    // With background loading the warm up runs in the background as well
+    runWhenLoaded([=]() {
+      CALIPER(CALI_MARK_BEGIN("WARMUP");)
+      if (hdcache != nullptr) hdcache->warmup(batchSizes);
+      if (surrogate != nullptr) {
+        long inputDim = surrogate->inputDim();
+        if (inputDim <= 0 && hdcache != nullptr) inputDim = hdcache->dim();
+        CWARNING(Workflow,
+                 inputDim <= 0,
+                 "Cannot infer the inputs of the surrogate model, skipping "
+                 "its warm up")
+        if (inputDim > 0) surrogate->warmup(batchSizes, inputDim);
+      }
+      CALIPER(CALI_MARK_END("WARMUP");)
+    });
+  }
+
+  /** @brief Check periodically for a new surrogate model, load it in the
+   * background and swap it in between evaluate calls. A new model is loaded
+   * when the watched file is modified or when the database receives a
+   * message "ams-reload-model [path]".
+   * @param[in] periodMs The milliseconds between two checks. When 0
+   * reloading is disabled.
+   * @param[in] watchPath The model file to watch. When null the path of the
+   * surrogate model.
+   */
+  void set_model_reload(int periodMs, const char *watchPath)
+  {
+    std::string path = (watchPath != nullptr) ? watchPath : modelPath;
+    runWhenLoaded([=]() {
+      stopReloader();
+      if (periodMs <= 0) return;
+      if (surrogate == nullptr || path.empty()) {
+        CWARNING(Workflow,
+                 true,
+                 "Reloading requires a surrogate model, ignoring")
+        return;
+      }
+      reloader = std::thread(&AMSWorkflow::reloadModels,
+                             this,
+                             path,
+                             std::chrono::milliseconds(periodMs));
+    });
+  }
+
+  /** @brief Add the inputs computed by the physics module to the UQ index,
+   * so that their region is accepted by later evaluate calls. Only
+   * supported on the CPU with a FAISS index.
+   * @param[in] batch The number of inputs collected before they are added.
+   * When 0 the index does not grow.
+   * @param[in] radius Inputs closer than this L2 distance to an indexed
+   * point are not added.
+   * @param[in] maxPoints The index stops growing once it holds this many
+   * points. No limit when 0.
+   */
+  void set_online_uq(long batch, double radius, long maxPoints)
+  {
+    uqMaxPoints = std::max(0L, maxPoints);
+    uqAddRadius = std::max(0.0, radius);
+    if (batch <= 0) {
+      uqAddBatch = 0;
+      return;
+    }
+    CWARNING(Workflow,
+             !isCPU,
+             "Growing the UQ index is only supported on the CPU, ignoring")
+    if (!isCPU) return;
+    runWhenLoaded([=]() {
+      if (hdcache == nullptr || hdcache->is_random()) {
+        CWARNING(Workflow,
+                 true,
+                 "Growing the UQ index requires a FAISS index, ignoring")
+        return;
+      }
+      uqAddBatch = batch;
+    });
+  }
+
+  /** @brief Stream large problems through evaluate in tiles.
+   * @param[in] elements The maximum number of elements of a tile. Values
+   * smaller than 1 disable tiling.
+   */
+  void set_tile_size(long elements) { tileSize = std::max(0L, elements); }
+
+  /** @brief Move database stores to a background thread.
+   * @param[in] nBuffers The number of staging buffers. Once all of them are
+   * pending, storing blocks until the background thread frees one.
+   */
+  void set_db_async(int nBuffers)
+  {
+    if (DB == nullptr || nBuffers <= 0) return;
+    DBG(Workflow, "Storing data asynchronously (%d buffers)", nBuffers);
+    DB = new AsyncDB<FPTypeValue>(DB, nBuffers, rId);
+    dbIsAsync = true;
+  }
+
+  /** @brief The maximum number of bytes of scratch memory a single evaluate
+   * call used */
+  size_t getScratchHighWaterMark() const
+  {
+    return scratchPool.highWaterMark();
+  }
+
+  /** @brief The number of bytes of scratch memory owned by the workflow */
+  size_t getScratchCapacity() const { return scratchPool.capacity(); }
+
   ~AMSWorkflow()
   {
     DBG(Workflow, "Destroying Workflow Handler");
+    if (loading.valid()) loading.wait();
+    stopReloader();
     if (hdcache) delete hdcache;
 
     if (surrogate) delete surrogate;
@@ -244,6 +1026,8 @@ public:
    * @param[in] totalElements the total number of elements to apply the SPMD
    * function on
    * @param[in] inputs the inputs of the computation.
+   * @param[in] inputDim the number of inputs.
+   * @param[in] outputDim the number of outputs.
    * @param[out] outputs the computed outputs.
    * @param[in] Comm The MPI Communicatotor for all ranks participating in the
    * SPMD execution.
@@ -282,9 +1066,13 @@ public:
    *
    * This transformation can exploit the parallel nature of all the required
    * steps.
+   *
+   * When a tile size is set, the elements are processed in consecutive tiles
+   * of at most that many elements. Every tile goes through all the steps
+   * above, so memory usage is bounded by the tile size.
    */
   void evaluate(void *probDescr,
-                const int totalElements,
+                const long totalElements,
                 const FPTypeValue **inputs,
                 FPTypeValue **outputs,
                 int inputDim,
@@ -292,39 +1080,336 @@ public:
                 MPI_Comm Comm = nullptr)
   {
     CDEBUG(Workflow, rId==0, "Entering Evaluate "
-        "with problem dimensions [(%d, %d, %d, %d)]",
+        "with problem dimensions [(%ld, %d, %ld, %d)]",
         totalElements, inputDim, totalElements, outputDim);
     // To move around the inputs, outputs we bundle them as std::vectors
     std::vector<const FPTypeValue *> origInputs(inputs, inputs + inputDim);
     std::vector<FPTypeValue *> origOutputs(outputs, outputs + outputDim);
 
-    if ( surrogate == nullptr ){
+    // Reading the models is only safe once they are loaded
+    if (!modelsReady(Comm) || surrogate == nullptr) {
       FPTypeValue **tmpInputs = const_cast<FPTypeValue**>(inputs);
 
       std::vector<FPTypeValue *> tmpIn(tmpInputs, tmpInputs + inputDim);
       DBG(Workflow, "No-Model, I am calling Physics code (for all data)");
-      AppCall(probDescr,
-              totalElements,
-              reinterpret_cast<const void **>(origInputs.data()),
-              reinterpret_cast<void **>(origOutputs.data()));
+      {
+        ams::WorkflowStats::Timer timer(stats, AMSStage::StagePhysics);
+        AppCall(probDescr,
+                totalElements,
+                reinterpret_cast<const void **>(origInputs.data()),
+                reinterpret_cast<void **>(origOutputs.data()));
+      }
       if (DB != nullptr) {
         CALIPER(CALI_MARK_BEGIN("DBSTORE");)
         Store(totalElements,  tmpIn,
           origOutputs);
         CALIPER(CALI_MARK_END("DBSTORE");)
       }
+      stats.addCall(totalElements, totalElements);
+      return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    const long tElements =
+        (tileSize > 0) ? std::min(tileSize, totalElements) : totalElements;
+    long numTiles =
+        (tElements > 0) ? (totalElements + tElements - 1) / tElements : 0;
+
+#ifdef __ENABLE_MPI__
+    // Load balancing is collective, every rank needs to go through the same
+    // number of tiles. This includes ranks without elements when the
+    // elements are not tiled.
+    if (ePolicy == AMSExecPolicy::BALANCED && Comm) {
+      long localTiles = numTiles;
+      MPI_Allreduce(&localTiles, &numTiles, 1, MPI_LONG, MPI_MAX, Comm);
+    }
+#endif
+
+    if (memoCapacity > 0) {
+      std::call_once(memoCreated, [&]() {
+        memo = std::unique_ptr<ams::MemoizationCache<FPTypeValue>>(
+            new ams::MemoizationCache<FPTypeValue>(
+                inputDim, outputDim, memoCapacity, memoTolerance));
+      });
+    }
+    swapStagedModel();
+
+    // All temporaries of this call live in the scratch arena. Packed buffers
+    // never hold more than a tile of values, so we reserve for the worst
+    // case once and the arena is reused as is by all tiles and by the
+    // following calls. Concurrent callers get distinct arenas.
+    auto scratch = scratchPool.acquire();
+    size_t footprint = scratchFootprint(tElements, inputDim, outputDim);
+    if (memo) footprint += scratchFootprint(tElements, inputDim, outputDim);
+    scratch->reserve(footprint);
+
+    std::vector<const FPTypeValue *> tInputs(inputDim);
+    std::vector<FPTypeValue *> tOutputs(outputDim);
+    long physicsElements = 0;
+    for (long t = 0; t < numTiles; t++) {
+      const long offset = std::min(t * tElements, totalElements);
+      const long numElements = std::min(tElements, totalElements - offset);
+      CDEBUG(Workflow,
+             rId == 0 && numTiles > 1,
+             "Evaluating tile %ld/%ld with %ld elements",
+             t + 1,
+             numTiles,
+             numElements);
+      for (int i = 0; i < inputDim; i++)
+        tInputs[i] = origInputs[i] + offset;
+      for (int i = 0; i < outputDim; i++)
+        tOutputs[i] = origOutputs[i] + offset;
+
+      scratch->reset();
+      physicsElements += evaluateTile(
+          *scratch, probDescr, offset, numElements, tInputs, tOutputs, Comm);
+    }
+
+    // Temporal data stay in the scratch arena for the next call
+    scratch->reset();
+
+    stats.addCall(totalElements, physicsElements);
+    adaptThreshold(physicsElements, totalElements, start);
+  }
+
+  /** @brief Evaluates a batch of independent problems (e.g. materials) that
+   * share this workflow.
+   * @param[in] items The problems to evaluate. Each item holds its own
+   * application descriptor, number of elements, inputs and outputs.
+   * @param[in] inputDim The number of inputs of every item
+   * @param[in] outputDim The number of outputs of every item
+   *
+   * @details The inputs of all items are concatenated, so the UQ module and
+   * the surrogate model are invoked once for the whole batch and the data of
+   * the physics module are stored with a single database call. The physics
+   * module is still invoked once per item with the item's descriptor on the
+   * rejected elements of that item. Items are evaluated one by one while the
+   * models load, with memoization, which works on single problems, and when
+   * their concatenation exceeds the tile size.
+   */
+  void evaluateBatch(std::vector<AMSBatchItem> &items,
+                     int inputDim,
+                     int outputDim)
+  {
+    long totalElements = 0;
+    for (auto &item : items)
+      totalElements += item.numElements;
+
+    // Concatenating the items would exceed the tile, evaluate them one by
+    // one instead, each item is tiled on its own. Memoization works on
+    // single items as well.
+    if (items.size() == 1 || !modelsReady() || surrogate == nullptr ||
+        memoCapacity > 0 ||
+        (tileSize > 0 && totalElements > tileSize)) {
+      for (auto &item : items) {
+        evaluate(item.probDescr,
+                 item.numElements,
+                 reinterpret_cast<const FPTypeValue **>(item.inputs),
+                 reinterpret_cast<FPTypeValue **>(item.outputs),
+                 inputDim,
+                 outputDim);
+      }
       return;
     }
+
+    swapStagedModel();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Segment> segments;
+    long offset = 0;
+    for (auto &item : items) {
+      segments.push_back({item.probDescr, offset, item.numElements, 0});
+      offset += item.numElements;
+    }
+
+    CDEBUG(Workflow,
+           rId == 0,
+           "Entering Batched Evaluate with %ld items and problem dimensions "
+           "[(%ld, %d, %ld, %d)]",
+           items.size(),
+           totalElements,
+           inputDim,
+           totalElements,
+           outputDim);
+
+    auto scratch = scratchPool.acquire();
+    scratch->reserve(scratchFootprint(totalElements, inputDim, outputDim) +
+                    (inputDim + outputDim) *
+                        ams::ScratchArena::footprint<FPTypeValue>(
+                            totalElements));
+
+    CALIPER(CALI_MARK_BEGIN("BATCH GATHER");)
+    std::vector<const FPTypeValue *> batchInputs;
+    std::vector<FPTypeValue *> batchOutputs;
+    for (int i = 0; i < inputDim; i++) {
+      FPTypeValue *dest = scratch->allocate<FPTypeValue>(totalElements);
+      for (size_t j = 0; j < items.size(); j++) {
+        FPTypeValue *src = const_cast<FPTypeValue *>(
+            reinterpret_cast<const FPTypeValue *>(items[j].inputs[i]));
+        ams::ResourceManager::copy(src,
+                                   &dest[segments[j].offset],
+                                   segments[j].numElements *
+                                       sizeof(FPTypeValue));
+      }
+      batchInputs.push_back(dest);
+    }
+    for (int i = 0; i < outputDim; i++)
+      batchOutputs.push_back(scratch->allocate<FPTypeValue>(totalElements));
+    CALIPER(CALI_MARK_END("BATCH GATHER");)
+
+    long physicsElements = evaluateSegments(
+        *scratch, segments, totalElements, batchInputs, batchOutputs);
+
+    CALIPER(CALI_MARK_BEGIN("BATCH SCATTER");)
+    for (int i = 0; i < outputDim; i++) {
+      for (size_t j = 0; j < items.size(); j++) {
+        FPTypeValue *dest = reinterpret_cast<FPTypeValue *>(items[j].outputs[i]);
+        ams::ResourceManager::copy(&batchOutputs[i][segments[j].offset],
+                                   dest,
+                                   segments[j].numElements *
+                                       sizeof(FPTypeValue));
+      }
+    }
+    CALIPER(CALI_MARK_END("BATCH SCATTER");)
+
+    scratch->reset();
+
+    stats.addCall(totalElements, physicsElements);
+    adaptThreshold(physicsElements, totalElements, start);
+  }
+
+private:
+  /** @brief A contiguous range of elements that the physics module
+   * computes with the same application descriptor */
+  struct Segment {
+    void *probDescr;
+    long offset;
+    long numElements;
+    /** @brief The position of the first element in the arrays of the
+     * application, or -1 when the elements are not in application order */
+    long slot;
+  };
+
+  /** @brief The number of bytes of scratch memory evaluateSegments needs */
+  static size_t scratchFootprint(long totalElements, int inputDim, int outputDim)
+  {
+    return ams::ScratchArena::footprint<bool>(totalElements) +
+           (inputDim + outputDim) *
+               ams::ScratchArena::footprint<FPTypeValue>(totalElements);
+  }
+
+  /** @brief Evaluates a tile of a single problem, returning the outputs of
+   * memoized elements directly.
+   * @param[in] scratch The arena holding the temporaries of the call
+   * @param[in] probDescr The application descriptor
+   * @param[in] slot The position of the tile in the application arrays
+   * @param[in] numElements The number of elements of the tile
+   * @param[in] inputs The inputs of the tile
+   * @param[out] outputs The outputs of the tile
+   * @param[in] Comm The MPI Communicator used to balance the physics module
+   * @return The number of elements computed by the physics module.
+   */
+  long evaluateTile(ams::ScratchArena &scratch,
+                    void *probDescr,
+                    long slot,
+                    long numElements,
+                    std::vector<const FPTypeValue *> &inputs,
+                    std::vector<FPTypeValue *> &outputs,
+                    MPI_Comm Comm)
+  {
+    if (!memo) {
+      std::vector<Segment> segments{{probDescr, 0, numElements, slot}};
+      return evaluateSegments(
+          scratch, segments, numElements, inputs, outputs, Comm);
+    }
+
+    const int inputDim = inputs.size();
+    const int outputDim = outputs.size();
+    bool *hits = scratch.allocate<bool>(numElements);
+    std::vector<FPTypeValue *> missInputs, missOutputs;
+    for (int i = 0; i < inputDim; i++)
+      missInputs.push_back(scratch.allocate<FPTypeValue>(numElements));
+    for (int i = 0; i < outputDim; i++)
+      missOutputs.push_back(scratch.allocate<FPTypeValue>(numElements));
+
+    long numMisses;
+    {
+      ams::WorkflowStats::Timer timer(stats, AMSStage::StageMemoization);
+      size_t found = memo->lookup(numElements, inputs, outputs, hits);
+      stats.addMemoHits(found);
+      numMisses = data_handler::pack(hits, numElements, inputs, missInputs);
+    }
+    DBG(Workflow, "Found %ld of %ld elements in the memoization cache",
+        numElements - numMisses, numElements);
+
+    // Even when every element was found we go through the pipeline, load
+    // balancing expects all ranks to participate.
+    std::vector<const FPTypeValue *> cMissInputs(missInputs.begin(),
+                                                 missInputs.end());
+    std::vector<Segment> segments{{probDescr, 0, numMisses, -1}};
+    long physicsElements = evaluateSegments(
+        scratch, segments, numMisses, cMissInputs, missOutputs, Comm);
+
+    {
+      ams::WorkflowStats::Timer timer(stats, AMSStage::StageMemoization);
+      if (!memoPhysicsOnly) memo->insert(numMisses, cMissInputs, missOutputs);
+      data_handler::unpack(hits, numElements, missOutputs, outputs);
+    }
+    return physicsElements;
+  }
+
+  /** @brief Runs UQ, the surrogate model and the physics module on a set of
+   * elements.
+   * @param[in] scratch The arena holding the temporaries of the call
+   * @param[in] segments Consecutive ranges of the elements, each computed by
+   * the physics module with its own application descriptor.
+   * @param[in] totalElements The total number of elements of all segments
+   * @param[in] origInputs The inputs of all segments
+   * @param[out] origOutputs The outputs of all segments
+   * @param[in] Comm The MPI Communicator used to balance the physics module
+   * @return The number of elements computed by the physics module.
+   * @pre The scratch arena has been reserved for scratchFootprint() bytes.
+   */
+  long evaluateSegments(ams::ScratchArena &scratch,
+                        std::vector<Segment> &segments,
+                        long totalElements,
+                        std::vector<const FPTypeValue *> &origInputs,
+                        std::vector<FPTypeValue *> &origOutputs,
+                        MPI_Comm Comm = nullptr)
+  {
+    const int inputDim = origInputs.size();
+    const int outputDim = origOutputs.size();
+
     // The predicate with which we will split the data on a later step
-    bool *p_ml_acceptable = ams::ResourceManager::allocate<bool>(totalElements);
+    bool *p_ml_acceptable = scratch.allocate<bool>(totalElements);
 
     // -------------------------------------------------------------
     // STEP 1: call the hdcache to look at input uncertainties
     //         to decide if making a ML inference makes sense
     // -------------------------------------------------------------
     if (hdcache != nullptr) {
+      ams::WorkflowStats::Timer timer(stats, AMSStage::StageUQ);
       CALIPER(CALI_MARK_BEGIN("UQ_MODULE");)
-      hdcache->evaluate(totalElements, origInputs, p_ml_acceptable);
+      if (uqTargetRecall > 0)
+        std::call_once(uqCalibrated,
+                       [&]() { calibrateUQ(totalElements, origInputs); });
+      bool tracked = (temporal != nullptr);
+      for (auto &segment : segments)
+        tracked = tracked && segment.slot >= 0;
+      if (tracked) {
+        for (auto &segment : segments) {
+          std::vector<const FPTypeValue *> sInputs;
+          for (int i = 0; i < inputDim; i++)
+            sInputs.push_back(origInputs[i] + segment.offset);
+          temporal->evaluate(*hdcache,
+                             segment.probDescr,
+                             segment.slot,
+                             segment.numElements,
+                             sInputs,
+                             p_ml_acceptable + segment.offset);
+        }
+      } else {
+        hdcache->evaluate(totalElements, origInputs, p_ml_acceptable);
+      }
       CALIPER(CALI_MARK_END("UQ_MODULE");)
     }
 
@@ -335,45 +1420,156 @@ public:
     std::vector<FPTypeValue *> packedInputs;
 
     for (int i = 0; i < inputDim; i++) {
-      packedInputs.emplace_back(
-          ams::ResourceManager::allocate<FPTypeValue>(totalElements));
+      packedInputs.emplace_back(scratch.allocate<FPTypeValue>(totalElements));
     }
 
     DBG(Workflow, "Allocated input resources")
 
     bool *predicate = p_ml_acceptable;
 
-    CALIPER(CALI_MARK_BEGIN("SURROGATE");)
-    // We need to call the model on all data values.
-    // Because we expect it to be faster.
-    // I guess we may need to add some policy to do this
-    DBG(Workflow, "Model exists, I am calling surrogate (for all data)");
-    surrogate->evaluate(totalElements, origInputs, origOutputs);
-    CALIPER(CALI_MARK_END("SURROGATE");)
-
     // -----------------------------------------------------------------
-    // STEP 3: call physics module only where d_dense_need_phys = true
+    // STEP 2: pack the data the physics module needs to compute
+    //         (where the uq flag is false). Rejected elements of every
+    //         segment are packed after the ones of the previous segment.
     // -----------------------------------------------------------------
-    // ---- 3a: we need to pack the sparse data based on the uq flag
-    const long packedElements =
-        data_handler::pack(predicate, totalElements, origInputs, packedInputs);
+    std::vector<long> packedOffsets;
+    long packedElements = 0;
+    {
+      ams::WorkflowStats::Timer timer(stats, AMSStage::StagePack);
+      for (auto &segment : segments) {
+        std::vector<const FPTypeValue *> sInputs;
+        std::vector<FPTypeValue *> pInputs;
+        for (int i = 0; i < inputDim; i++) {
+          sInputs.push_back(origInputs[i] + segment.offset);
+          pInputs.push_back(packedInputs[i] + packedElements);
+        }
+        packedOffsets.push_back(packedElements);
+        packedElements += data_handler::pack(
+            predicate + segment.offset, segment.numElements, sInputs, pInputs);
+      }
+      packedOffsets.push_back(packedElements);
+    }
 
     // Pointer values which store output data values
-    // to be computed using the eos function.
+    // to be computed using the eos function. They are sized for all
+    // elements, the accepted ones are packed after the physics ones
+    // when we run selective inference.
     std::vector<FPTypeValue *> packedOutputs;
     for (int i = 0; i < outputDim; i++) {
-      packedOutputs.emplace_back(
-          ams::ResourceManager::allocate<FPTypeValue>(packedElements));
+      packedOutputs.emplace_back(scratch.allocate<FPTypeValue>(totalElements));
+    }
+
+    // -----------------------------------------------------------------
+    // STEP 3: call the surrogate model on the data
+    // -----------------------------------------------------------------
+    // The surrogate and the physics module touch disjoint parts of the
+    // packed buffers, so on the CPU we can overlap them.
+    std::future<void> inference;
+    if (inferencePool) {
+      inference = inferencePool->submit([&]() {
+        evaluateSurrogate(predicate,
+                          totalElements,
+                          packedElements,
+                          origInputs,
+                          origOutputs,
+                          packedInputs,
+                          packedOutputs);
+      });
+    } else {
+      evaluateSurrogate(predicate,
+                        totalElements,
+                        packedElements,
+                        origInputs,
+                        origOutputs,
+                        packedInputs,
+                        packedOutputs);
+    }
+
+    // -----------------------------------------------------------------
+    // STEP 4: call physics module only where d_dense_need_phys = true
+    // -----------------------------------------------------------------
+    for (size_t s = 0; s < segments.size(); s++) {
+      std::vector<FPTypeValue *> pInputs, pOutputs;
+      for (int i = 0; i < inputDim; i++)
+        pInputs.push_back(packedInputs[i] + packedOffsets[s]);
+      for (int i = 0; i < outputDim; i++)
+        pOutputs.push_back(packedOutputs[i] + packedOffsets[s]);
+
+      evaluatePhysics(segments[s].probDescr,
+                      packedOffsets[s + 1] - packedOffsets[s],
+                      pInputs,
+                      pOutputs,
+                      Comm);
     }
 
+    // Surrogate results need to be in place before we unpack the physics
+    // ones, since full inference writes to all outputs.
+    if (inference.valid()) inference.get();
+
+    // ---- 4b: unpack the data
     {
-      void** iPtr = reinterpret_cast<void **>(packedInputs.data());
-      void** oPtr = reinterpret_cast<void **>(packedOutputs.data());
-      long lbElements = packedElements;
+      ams::WorkflowStats::Timer timer(stats, AMSStage::StageUnpack);
+      for (size_t s = 0; s < segments.size(); s++) {
+        std::vector<FPTypeValue *> sOutputs, pOutputs;
+        for (int i = 0; i < outputDim; i++) {
+          sOutputs.push_back(origOutputs[i] + segments[s].offset);
+          pOutputs.push_back(packedOutputs[i] + packedOffsets[s]);
+        }
+        data_handler::unpack(predicate + segments[s].offset,
+                             segments[s].numElements,
+                             pOutputs,
+                             sOutputs);
+      }
+    }
+
+    DBG(Workflow, "Finished physics evaluation")
+
+    if (memo && memoPhysicsOnly) {
+      ams::WorkflowStats::Timer timer(stats, AMSStage::StageMemoization);
+      std::vector<const FPTypeValue *> cPackedInputs(packedInputs.begin(),
+                                                     packedInputs.end());
+      memo->insert(packedElements, cPackedInputs, packedOutputs);
+    }
+
+    growUQ(packedElements, packedInputs);
+
+    if (DB != nullptr) {
+      CALIPER(CALI_MARK_BEGIN("DBSTORE");)
+      DBG(Workflow, "Storing data (#elements = %ld) to database", packedElements);
+      Store(packedElements, packedInputs, packedOutputs);
+      CALIPER(CALI_MARK_END("DBSTORE");)
+    }
+
+    DBG(Workflow, "Finished AMSExecution")
+    CINFO(Workflow, rId == 0, "Computed %ld "
+        "using physics out of the %ld items (%.2f)",
+        packedElements, totalElements, (float) (packedElements) / float( totalElements))
+    return packedElements;
+  }
+
+  /** @brief Calls the physics module on packed elements, balancing them
+   * across the ranks of the communicator when requested.
+   * @param[in] probDescr The application descriptor
+   * @param[in] packedElements The number of packed elements
+   * @param[in] packedInputs The packed inputs
+   * @param[out] packedOutputs The packed outputs
+   * @param[in] Comm The MPI Communicator of all ranks participating in the
+   * load balancing.
+   */
+  void evaluatePhysics(void *probDescr,
+                       long packedElements,
+                       std::vector<FPTypeValue *> &packedInputs,
+                       std::vector<FPTypeValue *> &packedOutputs,
+                       MPI_Comm Comm)
+  {
+    void** iPtr = reinterpret_cast<void **>(packedInputs.data());
+    void** oPtr = reinterpret_cast<void **>(packedOutputs.data());
+    long lbElements = packedElements;
 
 #ifdef __ENABLE_MPI__
+    ams::WorkflowStats::Timer lbTimer(stats, AMSStage::StageLoadBalance);
     CALIPER(CALI_MARK_BEGIN("LOAD BALANCE MODULE");)
-    AMSLoadBalancer<FPTypeValue> lBalancer(rId, wSize, packedElements, Comm, inputDim, outputDim, mLoc);
+    AMSLoadBalancer<FPTypeValue> lBalancer(rId, wSize, packedElements, Comm, packedInputs.size(), packedOutputs.size(), mLoc);
     if (ePolicy == AMSExecPolicy::BALANCED && Comm) {
       lBalancer.scatterInputs(packedInputs, mLoc);
       iPtr = reinterpret_cast<void **>(lBalancer.inputs());
@@ -381,54 +1577,45 @@ public:
       lbElements = lBalancer.getBalancedSize();
     }
     CALIPER(CALI_MARK_END("LOAD BALANCE MODULE");)
+    lbTimer.stop();
 #endif
 
-    // ---- 3b: call the physics module and store in the data base
+    // ---- 4a: call the physics module and store in the data base
     if (packedElements > 0 ) {
+      ams::WorkflowStats::Timer timer(stats, AMSStage::StagePhysics);
       CALIPER(CALI_MARK_BEGIN("PHYSICS MODULE");)
-      AppCall(probDescr,
-              lbElements,
-              iPtr,
-              oPtr);
+      if (physicsPool && lbElements > physicsGrain) {
+        const int inputDim = packedInputs.size();
+        const int outputDim = packedOutputs.size();
+        physicsPool->parallel_for(
+            lbElements, physicsGrain, [&](size_t begin, size_t end) {
+              std::vector<FPTypeValue *> cInputs(inputDim), cOutputs(outputDim);
+              for (int i = 0; i < inputDim; i++)
+                cInputs[i] = reinterpret_cast<FPTypeValue *>(iPtr[i]) + begin;
+              for (int i = 0; i < outputDim; i++)
+                cOutputs[i] = reinterpret_cast<FPTypeValue *>(oPtr[i]) + begin;
+              AppCall(probDescr,
+                      end - begin,
+                      reinterpret_cast<void **>(cInputs.data()),
+                      reinterpret_cast<void **>(cOutputs.data()));
+            });
+      } else {
+        AppCall(probDescr,
+                lbElements,
+                iPtr,
+                oPtr);
+      }
       CALIPER(CALI_MARK_END("PHYSICS MODULE");)
     }
 
 #ifdef __ENABLE_MPI__
+    ams::WorkflowStats::Timer gatherTimer(stats, AMSStage::StageLoadBalance);
     CALIPER(CALI_MARK_BEGIN("LOAD BALANCE MODULE");)
     if (ePolicy == AMSExecPolicy::BALANCED && Comm) {
       lBalancer.gatherOutputs(packedOutputs, mLoc);
     }
     CALIPER(CALI_MARK_END("LOAD BALANCE MODULE");)
 #endif
-    }
-
-    // ---- 3c: unpack the data
-    data_handler::unpack(predicate, totalElements, packedOutputs, origOutputs);
-
-    DBG(Workflow, "Finished physics evaluation")
-
-    if (DB != nullptr) {
-      CALIPER(CALI_MARK_BEGIN("DBSTORE");)
-      DBG(Workflow, "Storing data (#elements = %d) to database", packedElements);
-      Store(packedElements, packedInputs, packedOutputs);
-      CALIPER(CALI_MARK_END("DBSTORE");)
-    }
-
-    // -----------------------------------------------------------------
-    // Deallocate temporal data
-    // -----------------------------------------------------------------
-    for (int i = 0; i < inputDim; i++)
-      ams::ResourceManager::deallocate(packedInputs[i], mLoc);
-    for (int i = 0; i < outputDim; i++)
-      ams::ResourceManager::deallocate(packedOutputs[i], mLoc);
-
-    ams::ResourceManager::deallocate(p_ml_acceptable, mLoc);
-
-    DBG(Workflow, "Finished AMSExecution")
-    CINFO(Workflow, rId == 0, "Computed %ld "
-        "using physics out of the %ld items (%.2f)",
-        packedElements, totalElements, (float) (packedElements) / float( totalElements))
-
   }
 };
 
@@ -86,6 +86,25 @@ int main(int argc, char* argv[])
       }
     }
 
+    // Linearizing transposes the features and casts them
+    const size_t nfeatures = 9;
+    std::vector<std::vector<double>> features(nfeatures,
+                                              std::vector<double>(size));
+    std::vector<const double*> f_data;
+    for (size_t d = 0; d < nfeatures; d++) {
+      for (size_t i = 0; i < size; i++)
+        features[d][i] = i * nfeatures + d;
+      f_data.push_back(features[d].data());
+    }
+    std::vector<float> linear(size * nfeatures);
+    DataHandler<float>::linearize_features(size, f_data, linear.data());
+    for (size_t i = 0; i < size * nfeatures; i++) {
+      if (linear[i] != static_cast<float>(i)) {
+        std::cout << "Linearized value " << i << " is " << linear[i] << "\n";
+        return 1;
+      }
+    }
+
     ResourceManager::deallocate(predicate, AMSResourceType::HOST);
     ResourceManager::deallocate(dense, AMSResourceType::HOST);
     ResourceManager::deallocate(sparse, AMSResourceType::HOST);
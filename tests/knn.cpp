@@ -0,0 +1,222 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include <AMS.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <ml/hdcache.hpp>
+#include <ml/knn.hpp>
+#include <random>
+#include <vector>
+
+#define DIM 5
+#define POINTS (10 * 1000 + 3)
+#define QUERIES 1000
+#define K 4
+
+int main(int argc, char* argv[])
+{
+  using namespace ams;
+  int device = std::atoi(argv[1]);
+  // The native index runs on the host only
+  if (device == 1) return 0;
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  std::vector<float> points(POINTS * DIM), queries(QUERIES * DIM);
+  for (auto& v : points)
+    v = uniform(gen);
+  for (auto& v : queries)
+    v = uniform(gen);
+
+  KNNIndex index(DIM);
+  index.add(POINTS / 2, points.data());
+  index.add(POINTS - POINTS / 2, &points[(POINTS / 2) * DIM]);
+
+  std::vector<float> dists(QUERIES * K);
+  std::vector<KNNIndex::Label> labels(QUERIES * K);
+  index.search(QUERIES, queries.data(), K, dists.data(), labels.data());
+
+  // Compare with a naive search
+  std::vector<float> all(POINTS);
+  for (int q = 0; q < QUERIES; q++) {
+    for (int p = 0; p < POINTS; p++) {
+      float d = 0;
+      for (int k = 0; k < DIM; k++) {
+        float diff = points[p * DIM + k] - queries[q * DIM + k];
+        d += diff * diff;
+      }
+      all[p] = d;
+    }
+    std::partial_sort(all.begin(), all.begin() + K, all.end());
+    for (int i = 0; i < K; i++) {
+      if (std::abs(dists[q * K + i] - all[i]) > 1e-5) {
+        std::cout << "Query " << q << " neighbor " << i << " has distance "
+                  << dists[q * K + i] << " expected " << all[i] << "\n";
+        return 1;
+      }
+    }
+  }
+  std::cout << "Search [Done]\n";
+
+  // Early terminating decisions match the decisions of the full search
+  for (int mean = 0; mean < 2; mean++) {
+    std::vector<float> metrics(QUERIES);
+    for (int q = 0; q < QUERIES; q++) {
+      metrics[q] = dists[q * K + K - 1];
+      if (mean) {
+        double sum = 0;
+        for (int i = 0; i < K; i++)
+          sum += dists[q * K + i];
+        metrics[q] = (1.0f / K) * static_cast<float>(sum);
+      }
+    }
+    std::vector<float> sorted(metrics);
+    std::sort(sorted.begin(), sorted.end());
+    const float bound = sorted[QUERIES / 2];
+
+    std::unique_ptr<bool[]> accept(new bool[QUERIES]);
+    index.decide(QUERIES, queries.data(), K, bound, mean, accept.get());
+    int accepted = 0;
+    for (int q = 0; q < QUERIES; q++) {
+      const float metric = metrics[q];
+      accepted += accept[q];
+      if (accept[q] != (metric < bound) &&
+          std::abs(metric - bound) > 1e-6) {
+        std::cout << "Query " << q << " decided " << accept[q]
+                  << " with metric " << metric << "\n";
+        return 7;
+      }
+    }
+    if (accepted == 0 || accepted == QUERIES) {
+      std::cout << "Decisions do not exercise both outcomes\n";
+      return 8;
+    }
+  }
+  std::cout << "Decide [Done]\n";
+
+  // Fewer points than neighbors pad the results
+  KNNIndex small(DIM);
+  small.add(2, points.data());
+  small.search(1, queries.data(), K, dists.data(), labels.data());
+  if (labels[1] < 0 || labels[2] != -1 || labels[3] != -1) {
+    std::cout << "Missing neighbors are not reported as -1\n";
+    return 2;
+  }
+  std::cout << "Padding [Done]\n";
+
+  const std::string path("ams_knn_test.knn");
+  index.write(path);
+  if (!KNNIndex::is_native(path)) {
+    std::cout << "Written index is not recognized\n";
+    return 3;
+  }
+  std::unique_ptr<KNNIndex> loaded(KNNIndex::read(path));
+  if (!loaded || loaded->count() != POINTS || loaded->dim() != DIM) {
+    std::cout << "Read index does not match the written one\n";
+    return 4;
+  }
+  std::cout << "File [Done]\n";
+
+  // Written indices are mapped, searched like the original one and copied
+  // when points are added
+  std::vector<float> mappedDists(QUERIES * K);
+  std::vector<KNNIndex::Label> mappedLabels(QUERIES * K);
+  loaded->search(
+      QUERIES, queries.data(), K, mappedDists.data(), mappedLabels.data());
+  std::vector<float> expected(QUERIES * K);
+  index.search(QUERIES, queries.data(), K, expected.data(), labels.data());
+  if (!loaded->is_mapped() || mappedDists != expected ||
+      mappedLabels != labels) {
+    std::cout << "Mapped index differs from the written one\n";
+    return 9;
+  }
+  KNNIndex grown(*loaded);
+  grown.add(1, queries.data());
+  if (grown.is_mapped() || grown.count() != POINTS + 1 ||
+      !loaded->is_mapped() || loaded->count() != POINTS) {
+    std::cout << "Adding points modified the mapped index\n";
+    return 10;
+  }
+  std::cout << "Map [Done]\n";
+
+  // Files storing points one after the other are still read
+  const std::string rowsPath("ams_knn_rows_test.knn");
+  {
+    std::ofstream rows(rowsPath, std::ios::binary);
+    const int64_t n = 2;
+    const int32_t dim = DIM, padding = 0;
+    rows.write("AMSKNN1", 8);
+    rows.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    rows.write(reinterpret_cast<const char*>(&dim), sizeof(dim));
+    rows.write(reinterpret_cast<const char*>(&padding), sizeof(padding));
+    rows.write(reinterpret_cast<const char*>(points.data()),
+               n * DIM * sizeof(float));
+  }
+  std::unique_ptr<KNNIndex> rowsIndex(KNNIndex::read(rowsPath));
+  std::remove(rowsPath.c_str());
+  std::vector<float> rowsDists(K);
+  if (!rowsIndex || rowsIndex->count() != 2 || rowsIndex->is_mapped()) {
+    std::cout << "Cannot read an index stored point after point\n";
+    return 11;
+  }
+  rowsIndex->search(1, points.data(), K, rowsDists.data(), labels.data());
+  if (rowsDists[0] != 0 || labels[0] != 0 || labels[1] != 1) {
+    std::cout << "Index stored point after point has wrong points\n";
+    return 12;
+  }
+  std::cout << "Rows [Done]\n";
+
+  // The indexed points are accepted, points far away are not
+  AMSSetupAllocator(AMSResourceType::HOST);
+  HDCache<double> cache(path, false, AMSUQPolicy::FAISSMean, K, 0.5);
+  std::vector<std::vector<double>> features(DIM, std::vector<double>(2));
+  for (int k = 0; k < DIM; k++) {
+    features[k][0] = points[k];
+    features[k][1] = 10;
+  }
+  std::vector<const double*> inputs;
+  for (auto& f : features)
+    inputs.push_back(f.data());
+  bool predicate[2];
+  cache.evaluate(2, inputs, predicate);
+  if (!predicate[0] || predicate[1]) {
+    std::cout << "Unexpected predicate " << predicate[0] << predicate[1]
+              << "\n";
+    return 5;
+  }
+  std::cout << "HDCache [Done]\n";
+
+  // Searching in parallel chunks gives the same decisions as a single search
+  std::vector<std::vector<double>> many(DIM, std::vector<double>(QUERIES));
+  std::vector<const double*> manyInputs;
+  for (int k = 0; k < DIM; k++) {
+    for (int q = 0; q < QUERIES; q++)
+      many[k][q] = queries[q * DIM + k];
+    manyInputs.push_back(many[k].data());
+  }
+  std::unique_ptr<bool[]> whole(new bool[QUERIES]), chunked(new bool[QUERIES]);
+  std::vector<double> wholeMetric(QUERIES), chunkedMetric(QUERIES);
+  cache.set_search_chunk(QUERIES);
+  cache.evaluate(QUERIES, manyInputs, whole.get(), wholeMetric.data());
+  cache.set_search_chunk(64);
+  cache.evaluate(QUERIES, manyInputs, chunked.get(), chunkedMetric.data());
+  for (int q = 0; q < QUERIES; q++) {
+    if (whole[q] != chunked[q] || wholeMetric[q] != chunkedMetric[q]) {
+      std::cout << "Chunked search differs at " << q << "\n";
+      return 6;
+    }
+  }
+  std::cout << "Chunks [Done]\n";
+
+  std::remove(path.c_str());
+  return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include <AMS.h>
+
+#include <iostream>
+#include <vector>
+#include <wf/memoization.hpp>
+
+#define SIZE (4 * 1024)
+
+int main(int argc, char* argv[])
+{
+  using namespace ams;
+  int device = std::atoi(argv[1]);
+  // The cache holds host memory only
+  if (device == 1) return 0;
+
+  std::vector<double> in0(SIZE), in1(SIZE), out(SIZE);
+  for (int i = 0; i < SIZE; i++) {
+    in0[i] = i;
+    in1[i] = 2 * i;
+    out[i] = 3 * i;
+  }
+  std::vector<const double*> inputs{in0.data(), in1.data()};
+  std::vector<double*> outputs{out.data()};
+  bool* hits = new bool[SIZE];
+
+  MemoizationCache<double> cache(2, 1, 8 * SIZE, 0.1);
+
+  if (cache.lookup(SIZE, inputs, outputs, hits) != 0) {
+    std::cout << "Empty cache reported hits\n";
+    return 1;
+  }
+
+  cache.insert(SIZE, inputs, outputs);
+
+  // Perturb inputs below the tolerance and clear outputs
+  std::vector<double> p0(SIZE), p1(SIZE), res(SIZE, -1);
+  for (int i = 0; i < SIZE; i++) {
+    p0[i] = in0[i] + 0.01;
+    p1[i] = in1[i] - 0.01;
+  }
+  std::vector<const double*> pInputs{p0.data(), p1.data()};
+  std::vector<double*> pOutputs{res.data()};
+  size_t found = cache.lookup(SIZE, pInputs, pOutputs, hits);
+  if (found != SIZE) {
+    std::cout << "Found " << found << " of " << SIZE << " elements\n";
+    return 2;
+  }
+  for (int i = 0; i < SIZE; i++) {
+    if (!hits[i] || res[i] != out[i]) {
+      std::cout << "Element " << i << " has output " << res[i] << " expected "
+                << out[i] << "\n";
+      return 3;
+    }
+  }
+  std::cout << "Lookup [Done]\n";
+
+  // Inputs beyond the tolerance are misses
+  for (int i = 0; i < SIZE; i++)
+    p0[i] = in0[i] + 0.5;
+  if (cache.lookup(SIZE, pInputs, pOutputs, hits) != 0) {
+    std::cout << "Distant inputs were found\n";
+    return 4;
+  }
+  std::cout << "Tolerance [Done]\n";
+
+  // Cleared caches hold no elements
+  cache.clear();
+  if (cache.lookup(SIZE, inputs, pOutputs, hits) != 0) {
+    std::cout << "Cleared cache reported hits\n";
+    return 6;
+  }
+  std::cout << "Clear [Done]\n";
+
+  // Inserting more elements than the capacity keeps the cache bounded
+  MemoizationCache<double> small(2, 1, 64, 0);
+  small.insert(SIZE, inputs, outputs);
+  found = small.lookup(SIZE, inputs, outputs, hits);
+  if (found > small.capacity() || found == 0) {
+    std::cout << "Small cache found " << found << " elements with capacity "
+              << small.capacity() << "\n";
+    return 5;
+  }
+  std::cout << "Eviction [Done]\n";
+
+  delete[] hits;
+  return 0;
+}
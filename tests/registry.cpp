@@ -0,0 +1,83 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include <AMS.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <ml/registry.hpp>
+#include <string>
+
+int main(int argc, char* argv[])
+{
+  using namespace ams;
+  int device = std::atoi(argv[1]);
+  // The registry holds host objects only
+  if (device == 1) return 0;
+
+  const std::string path("ams_registry_test.txt");
+  std::ofstream(path) << "model";
+
+  int loads = 0;
+  auto load = [&]() {
+    loads++;
+    return std::make_shared<int>(loads);
+  };
+
+  auto first = Registry<int>::get(path, "float64", "cpu", load);
+  auto second = Registry<int>::get(path, "float64", "cpu", load);
+  if (loads != 1 || first.get() != second.get()) {
+    std::cout << "Identical requests loaded " << loads << " objects\n";
+    return 1;
+  }
+  std::cout << "Share [Done]\n";
+
+  auto single = Registry<int>::get(path, "float32", "cpu", load);
+  auto device_ = Registry<int>::get(path, "float64", "cuda", load);
+  auto tuned = Registry<int>::get(path, "float64", "cpu", load, "nprobe=16");
+  if (loads != 4 || single.get() == first.get() ||
+      device_.get() == first.get() || tuned.get() == first.get()) {
+    std::cout << "Different types, devices or options shared objects\n";
+    return 2;
+  }
+  std::cout << "Keys [Done]\n";
+
+  // The object is destroyed with its last user and loaded again afterwards
+  std::weak_ptr<int> weak = first;
+  first.reset();
+  if (weak.expired()) {
+    std::cout << "Object destroyed while in use\n";
+    return 3;
+  }
+  second.reset();
+  if (!weak.expired()) {
+    std::cout << "Object outlived its users\n";
+    return 4;
+  }
+  auto again = Registry<int>::get(path, "float64", "cpu", load);
+  if (loads != 5) {
+    std::cout << "Released object was not loaded again\n";
+    return 5;
+  }
+  std::cout << "Release [Done]\n";
+
+  // Failed loads are not registered
+  auto failed = Registry<int>::get(path, "int", "cpu", []() {
+    return std::shared_ptr<int>();
+  });
+  auto retried = Registry<int>::get(path, "int", "cpu", load);
+  if (failed || !retried || loads != 6) {
+    std::cout << "Failed load was registered\n";
+    return 6;
+  }
+  std::cout << "Failure [Done]\n";
+
+  std::remove(path.c_str());
+  return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include <AMS.h>
+
+#include <cstdint>
+#include <iostream>
+#include <wf/resource_manager.hpp>
+#include <wf/scratch_arena.hpp>
+
+#define SIZE (32 * 1024 + 3)
+
+int main(int argc, char* argv[])
+{
+  using namespace ams;
+  int device = std::atoi(argv[1]);
+
+  AMSSetupAllocator(AMSResourceType::HOST);
+  AMSResourceType resource = AMSResourceType::HOST;
+  if (device == 1) {
+    AMSSetupAllocator(AMSResourceType::DEVICE);
+    AMSSetDefaultAllocator(AMSResourceType::DEVICE);
+    resource = AMSResourceType::DEVICE;
+  }
+
+  ScratchArena arena(resource);
+
+  const size_t bytes = ScratchArena::footprint<bool>(SIZE) +
+                       3 * ScratchArena::footprint<double>(SIZE);
+  arena.reserve(bytes);
+  bool* pred = arena.allocate<bool>(SIZE);
+  double* buffers[3];
+  for (int i = 0; i < 3; i++)
+    buffers[i] = arena.allocate<double>(SIZE);
+
+  if (reinterpret_cast<uintptr_t>(pred) % ScratchArena::alignment != 0) {
+    std::cout << "Predicate buffer is not aligned\n";
+    return 1;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    if (reinterpret_cast<uintptr_t>(buffers[i]) % ScratchArena::alignment !=
+        0) {
+      std::cout << "Buffer " << i << " is not aligned\n";
+      return 1;
+    }
+  }
+  std::cout << "Aligned allocations [Done]\n";
+
+  if (arena.highWaterMark() != bytes) {
+    std::cout << "High water mark is " << arena.highWaterMark()
+              << " expected " << bytes << "\n";
+    return 2;
+  }
+  std::cout << "High water mark [Done]\n";
+
+  // A smaller request must reuse the existing memory
+  arena.reserve(ScratchArena::footprint<double>(SIZE));
+  double* reused = arena.allocate<double>(SIZE);
+  if (reused != reinterpret_cast<double*>(pred) || arena.allocations() != 1 ||
+      arena.capacity() != bytes) {
+    std::cout << "Arena did not reuse its memory\n";
+    return 3;
+  }
+  std::cout << "Reuse [Done]\n";
+
+  // A larger request grows the arena, but keeps the high water mark
+  arena.reserve(2 * bytes);
+  arena.allocate<double>(SIZE);
+  if (arena.allocations() != 2 || arena.capacity() != 2 * bytes ||
+      arena.highWaterMark() != bytes) {
+    std::cout << "Arena did not grow correctly\n";
+    return 4;
+  }
+  std::cout << "Grow [Done]\n";
+
+  // Arenas held at the same time are distinct, released ones are reused
+  ScratchPool pool(resource);
+  {
+    auto first = pool.acquire();
+    auto second = pool.acquire();
+    if (&*first == &*second || pool.size() != 2) {
+      std::cout << "Pool handed out the same arena twice\n";
+      return 5;
+    }
+  }
+  {
+    auto again = pool.acquire();
+    if (pool.size() != 2) {
+      std::cout << "Pool did not reuse a released arena\n";
+      return 6;
+    }
+  }
+  std::cout << "Pool [Done]\n";
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include <AMS.h>
+
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <wf/thread_pool.hpp>
+
+#define SIZE (32 * 1024 + 7)
+
+int main(int argc, char* argv[])
+{
+  using namespace ams;
+  int device = std::atoi(argv[1]);
+  // The pool runs host threads only
+  if (device == 1) return 0;
+
+  ThreadPool pool(4);
+
+  auto result = pool.submit([]() {});
+  result.get();
+  std::cout << "Submit [Done]\n";
+
+  // Every iteration is visited exactly once
+  std::vector<int> visits(SIZE, 0);
+  std::atomic<int> calls(0);
+  pool.parallel_for(SIZE, 1000, [&](size_t begin, size_t end) {
+    if (end - begin > 1000) throw std::runtime_error("Range exceeds grain");
+    for (size_t i = begin; i < end; i++)
+      visits[i]++;
+    calls++;
+  });
+
+  for (int i = 0; i < SIZE; i++) {
+    if (visits[i] != 1) {
+      std::cout << "Iteration " << i << " visited " << visits[i] << " times\n";
+      return 1;
+    }
+  }
+  if (calls != (SIZE + 999) / 1000) {
+    std::cout << "Expected " << (SIZE + 999) / 1000 << " ranges, got " << calls
+              << "\n";
+    return 2;
+  }
+  std::cout << "Parallel for [Done]\n";
+
+  // Exceptions of any range reach the caller
+  bool caught = false;
+  try {
+    pool.parallel_for(SIZE, 100, [&](size_t begin, size_t end) {
+      if (begin <= SIZE / 2 && SIZE / 2 < end)
+        throw std::runtime_error("Failing range");
+    });
+  } catch (std::runtime_error&) {
+    caught = true;
+  }
+  if (!caught) {
+    std::cout << "Exception was not propagated\n";
+    return 3;
+  }
+  std::cout << "Exceptions [Done]\n";
+
+  return 0;
+}
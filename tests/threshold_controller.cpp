@@ -0,0 +1,96 @@
+/*
+ * Copyright 2021-2023 Lawrence Livermore National Security, LLC and other
+ * AMSLib Project Developers
+ *
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include <AMS.h>
+
+#include <iostream>
+#include <limits>
+#include <wf/threshold_controller.hpp>
+
+int main(int argc, char* argv[])
+{
+  using namespace ams;
+  int device = std::atoi(argv[1]);
+  // The controller runs on the host only
+  if (device == 1) return 0;
+
+  // Too many physics elements raise the threshold, too few lower it
+  ThresholdController fraction(1.0, 0.1, 0, 0, 100);
+  double up = fraction.update(50, 100, 0);
+  double down = fraction.update(0, 100, 0);
+  if (!(up > 1.0) || !(down < up)) {
+    std::cout << "Fraction target moved the threshold to " << up << " and "
+              << down << "\n";
+    return 1;
+  }
+  std::cout << "Fraction [Done]\n";
+
+  // Slow calls raise the threshold, fast calls lower it
+  ThresholdController time(1.0, 0, 1.0, 0, 100);
+  up = time.update(0, 100, 4.0);
+  down = time.update(0, 100, 0.25);
+  if (!(up > 1.0) || !(down < up)) {
+    std::cout << "Time budget moved the threshold to " << up << " and "
+              << down << "\n";
+    return 2;
+  }
+  std::cout << "Time [Done]\n";
+
+  // A single update changes the threshold by at most maxStep times
+  const double maxStep = 2.0;
+  ThresholdController steep(1.0, 0.1, 0, 0, 100, 4.0, maxStep);
+  up = steep.update(100, 100, 0);
+  down = steep.update(0, 100, 0);
+  if (up > 1.0 * maxStep * (1 + 1e-12) || up <= 1.0 ||
+      down < up / maxStep * (1 - 1e-12) || down >= up) {
+    std::cout << "Steps of " << up << " and " << down / up
+              << " exceed the maximum step\n";
+    return 3;
+  }
+  std::cout << "Step [Done]\n";
+
+  // The threshold never leaves its bounds, starting with the initial one
+  ThresholdController bounded(10.0, 0.1, 0, 0.5, 1.5);
+  if (bounded.getThreshold() != 1.5) {
+    std::cout << "Initial threshold is not clamped\n";
+    return 4;
+  }
+  for (int i = 0; i < 10; i++)
+    bounded.update(100, 100, 0);
+  if (bounded.getThreshold() != 1.5) {
+    std::cout << "Threshold " << bounded.getThreshold()
+              << " exceeds the upper bound\n";
+    return 5;
+  }
+  for (int i = 0; i < 10; i++)
+    bounded.update(0, 100, 0);
+  if (bounded.getThreshold() != 0.5) {
+    std::cout << "Threshold " << bounded.getThreshold()
+              << " is below the lower bound\n";
+    return 6;
+  }
+  std::cout << "Bounds [Done]\n";
+
+  // Without physics elements a threshold of 0 stays at the floor and grows
+  // once physics elements exceed the target
+  ThresholdController zero(0, 0.1, 0, 0, 100);
+  for (int i = 0; i < 10; i++)
+    zero.update(0, 100, 0);
+  const double floor = std::numeric_limits<float>::epsilon();
+  if (zero.getThreshold() != floor) {
+    std::cout << "Threshold " << zero.getThreshold()
+              << " is not at the floor\n";
+    return 7;
+  }
+  if (!(zero.update(50, 100, 0) > floor)) {
+    std::cout << "Threshold does not grow from the floor\n";
+    return 8;
+  }
+  std::cout << "Floor [Done]\n";
+
+  return 0;
+}